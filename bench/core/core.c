@@ -0,0 +1,262 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * Latency of the core paths, for each transparency mode: creating an
+ * OSD, showing and hiding it, rendering it with an empty, an image and
+ * a text renderer, and the frames an aosd_flash() gets through.  Every
+ * sample waits for the server with aosd_sync(), so they measure the
+ * round trip rather than how fast requests can be queued.
+ *
+ * The results go to stdout as JSON, one object per measurement with its
+ * percentiles, for the next run to be diffed against.  Meant to be run
+ * against Xvfb or a dummy Xorg, through run.sh:
+ *
+ *   ../run.sh ./core [samples] > core.json
+ *
+ * The transparency asked for is not always the one granted (composite
+ * wants a compositing manager), so both are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <aosd.h>
+
+#define WIDTH 400
+#define HEIGHT 120
+
+static const char* trans_names[] = { "none", "fake", "composite" };
+
+static Bool first = True;
+
+static double
+now_us(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static int
+compare(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/* nearest rank, on sorted samples */
+static double
+percentile(double* samples, int n, int p)
+{
+  int rank = (p * n + 99) / 100;
+  return samples[rank > 0 ? rank - 1 : 0];
+}
+
+static void
+report(AosdTransparency asked, AosdTransparency got, const char* name,
+    const char* unit, double* samples, int n)
+{
+  double sum = 0;
+  int i;
+
+  if (n == 0)
+    return;
+
+  for (i = 0; i < n; i++)
+    sum += samples[i];
+  qsort(samples, n, sizeof(double), compare);
+
+  printf("%s\n    {\"transparency\": \"%s\", \"effective\": \"%s\", "
+      "\"name\": \"%s\", \"unit\": \"%s\", \"samples\": %d, "
+      "\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+      "\"max\": %.1f, \"mean\": %.1f}",
+      first ? "" : ",", trans_names[asked], trans_names[got], name, unit, n,
+      samples[0], percentile(samples, n, 50), percentile(samples, n, 90),
+      percentile(samples, n, 99), samples[n - 1], sum / n);
+  first = False;
+}
+
+static void
+render_empty(cairo_t* cr, void* data)
+{
+}
+
+static void
+render_image(cairo_t* cr, void* data)
+{
+  cairo_set_source_surface(cr, data, 0, 0);
+  cairo_paint(cr);
+}
+
+static void
+render_text(cairo_t* cr, void* data)
+{
+  cairo_set_source_rgba(cr, 0, 0, 0, 0.6);
+  cairo_paint(cr);
+
+  cairo_select_font_face(cr, "sans-serif",
+      CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+  cairo_set_font_size(cr, 32);
+  cairo_set_source_rgb(cr, 1, 1, 1);
+  cairo_move_to(cr, 20, 50);
+  cairo_show_text(cr, "Volume 42%");
+  cairo_set_font_size(cr, 18);
+  cairo_move_to(cr, 20, 90);
+  cairo_show_text(cr, "the quick brown fox jumps over the lazy dog");
+}
+
+/* a gradient with some alpha, so painting it isn't a plain copy */
+static cairo_surface_t*
+make_image(void)
+{
+  cairo_surface_t* image =
+    cairo_image_surface_create(CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT);
+  cairo_t* cr = cairo_create(image);
+  cairo_pattern_t* pat = cairo_pattern_create_linear(0, 0, WIDTH, HEIGHT);
+
+  cairo_pattern_add_color_stop_rgba(pat, 0, 0.9, 0.2, 0.1, 1);
+  cairo_pattern_add_color_stop_rgba(pat, 1, 0.1, 0.3, 0.9, 0.4);
+  cairo_set_source(cr, pat);
+  cairo_paint(cr);
+
+  cairo_pattern_destroy(pat);
+  cairo_destroy(cr);
+  return image;
+}
+
+static void
+count_frames(AosdFrame* frame, void* data)
+{
+  AosdFrame* last = data;
+  *last = *frame;
+}
+
+static Aosd*
+make_osd(AosdTransparency transparency)
+{
+  Aosd* aosd = aosd_new();
+
+  if (aosd == NULL)
+    exit(1);
+
+  aosd_set_transparency(aosd, transparency);
+  aosd_set_geometry(aosd, 0, 0, WIDTH, HEIGHT);
+  return aosd;
+}
+
+static void
+run(AosdTransparency transparency, int n, cairo_surface_t* image)
+{
+  static const struct
+  {
+    const char* name;
+    AosdRenderer render;
+  }
+  renderers[] =
+  {
+    { "render_empty", render_empty },
+    { "render_image", render_image },
+    { "render_text", render_text },
+  };
+  double* samples = calloc(n, sizeof(double));
+  double* dropped = calloc(n, sizeof(double));
+  AosdTransparency got;
+  AosdFrame last;
+  Aosd* aosd;
+  double start;
+  unsigned r;
+  int i;
+
+  /* creation, up to the window being there */
+  for (i = 0; i < n; i++)
+  {
+    start = now_us();
+    aosd = make_osd(transparency);
+    aosd_sync(aosd);
+    samples[i] = now_us() - start;
+    aosd_destroy(aosd);
+  }
+
+  aosd = make_osd(transparency);
+  got = aosd_get_transparency(aosd);
+  report(transparency, got, "new", "us", samples, n);
+
+  aosd_set_renderer(aosd, render_text, NULL);
+  for (i = 0; i < n; i++)
+  {
+    start = now_us();
+    aosd_show(aosd);
+    aosd_sync(aosd);
+    samples[i] = now_us() - start;
+
+    start = now_us();
+    aosd_hide(aosd);
+    aosd_sync(aosd);
+    dropped[i] = now_us() - start;
+  }
+  report(transparency, got, "show", "us", samples, n);
+  report(transparency, got, "hide", "us", dropped, n);
+
+  aosd_show(aosd);
+  aosd_sync(aosd);
+  aosd_loop_once(aosd);
+
+  for (r = 0; r < sizeof(renderers) / sizeof(renderers[0]); r++)
+  {
+    aosd_set_renderer(aosd, renderers[r].render, image);
+    aosd_render(aosd);
+    aosd_sync(aosd);
+
+    for (i = 0; i < n; i++)
+    {
+      start = now_us();
+      aosd_render(aosd);
+      aosd_sync(aosd);
+      samples[i] = now_us() - start;
+    }
+    report(transparency, got, renderers[r].name, "us", samples, n);
+  }
+
+  aosd_hide(aosd);
+
+  /* a flash is paced by the clock, so a few are plenty */
+  aosd_set_renderer(aosd, render_text, NULL);
+  aosd_set_frame_cb(aosd, count_frames, &last);
+  for (i = 0; i < n && i < 10; i++)
+  {
+    memset(&last, 0, sizeof(last));
+    aosd_flash(aosd, 200, 100, 200);
+    samples[i] = last.frame;
+    dropped[i] = last.dropped;
+  }
+  report(transparency, got, "flash_frames", "frames", samples, i);
+  report(transparency, got, "flash_dropped", "frames", dropped, i);
+
+  aosd_destroy(aosd);
+  free(dropped);
+  free(samples);
+}
+
+int main(int argc, char* argv[])
+{
+  int n = (argc > 1) ? atoi(argv[1]) : 200;
+  cairo_surface_t* image;
+
+  if (n <= 0)
+    n = 200;
+
+  image = make_image();
+
+  printf("{\"benchmark\": \"core\", \"width\": %d, \"height\": %d, "
+      "\"results\": [", WIDTH, HEIGHT);
+  run(TRANSPARENCY_NONE, n, image);
+  run(TRANSPARENCY_FAKE, n, image);
+  run(TRANSPARENCY_COMPOSITE, n, image);
+  printf("\n]}\n");
+
+  cairo_surface_destroy(image);
+  return 0;
+}
+
+/* vim: set ts=2 sw=2 et : */
@@ -0,0 +1,107 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * Compares server-side (XRender) and client-side (MIT-SHM) rasterization
+ * of a text-heavy renderer.  Meant to be run against Xvfb:
+ *
+ *   xvfb-run -s "-screen 0 1920x1080x24" ./rasterizer [frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <aosd.h>
+
+#define WIDTH 1200
+#define HEIGHT 200
+
+static void
+render(cairo_t* cr, void* data)
+{
+  int* frame = data;
+  char line[64];
+  int i;
+
+  cairo_set_source_rgba(cr, 0, 0, 0, 0.6);
+  cairo_paint(cr);
+
+  cairo_select_font_face(cr, "monospace",
+      CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cr, 14);
+  cairo_set_source_rgba(cr, 1, 1, 1, 0.9);
+
+  for (i = 0; i < HEIGHT / 16; i++)
+  {
+    snprintf(line, sizeof(line),
+        "frame %6d line %2d the quick brown fox jumps over", *frame, i);
+    cairo_move_to(cr, 8, 16 * (i + 1));
+    cairo_show_text(cr, line);
+  }
+
+  (*frame)++;
+}
+
+static double
+now_ms(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+run(AosdTransparency transparency, AosdRenderMode mode, int frames)
+{
+  const char* mode_names[] = { "server", "client" };
+  const char* trans_names[] = { "none", "fake", "composite" };
+  Aosd* aosd;
+  int frame = 0, i;
+  double start, elapsed;
+
+  aosd = aosd_new();
+  if (aosd == NULL)
+    exit(1);
+
+  aosd_set_transparency(aosd, transparency);
+  aosd_set_render_mode(aosd, mode);
+  aosd_set_geometry(aosd, 0, 0, WIDTH, HEIGHT);
+  aosd_set_renderer(aosd, render, &frame);
+  aosd_show(aosd);
+  aosd_sync(aosd);
+  aosd_loop_once(aosd);
+
+  start = now_ms();
+  for (i = 0; i < frames; i++)
+    aosd_render(aosd);
+  /* wait for the server to catch up */
+  aosd_sync(aosd);
+  elapsed = now_ms() - start;
+
+  printf("%-10s %-7s %8d %10.3f %10.1f\n",
+      trans_names[aosd_get_transparency(aosd)], mode_names[mode],
+      frames, elapsed / frames, frames * 1000.0 / elapsed);
+
+  aosd_destroy(aosd);
+}
+
+int main(int argc, char* argv[])
+{
+  int frames = (argc > 1) ? atoi(argv[1]) : 500;
+
+  if (frames <= 0)
+    frames = 500;
+
+  printf("%-10s %-7s %8s %10s %10s\n",
+      "trans", "raster", "frames", "ms/frame", "fps");
+
+  run(TRANSPARENCY_NONE, RENDER_SERVER, frames);
+  run(TRANSPARENCY_NONE, RENDER_CLIENT, frames);
+  run(TRANSPARENCY_FAKE, RENDER_SERVER, frames);
+  run(TRANSPARENCY_FAKE, RENDER_CLIENT, frames);
+  run(TRANSPARENCY_COMPOSITE, RENDER_SERVER, frames);
+  run(TRANSPARENCY_COMPOSITE, RENDER_CLIENT, frames);
+
+  return 0;
+}
+
+/* vim: set ts=2 sw=2 et : */
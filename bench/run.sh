@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Runs a benchmark on an X server of its own, so the numbers don't depend
+# on the desktop it's started from:
+#
+#   bench/run.sh bench/core/core 500 > core.json
+#
+# Xvfb is used by default.  AOSD_BENCH_SERVER=xorg runs a dummy Xorg
+# instead (xserver-xorg-video-dummy, with AOSD_BENCH_XORG_CONF for its
+# configuration), for timings closer to a real server.  A compositing
+# manager named in AOSD_BENCH_COMPOSITOR, e.g. xcompmgr, is started
+# first, otherwise composite transparency falls back to fake.
+
+SIZE=${AOSD_BENCH_SIZE:-1920x1080x24}
+DPY=${AOSD_BENCH_DISPLAY:-:77}
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 benchmark [args...]" >&2
+  exit 1
+fi
+
+case "${AOSD_BENCH_SERVER:-xvfb}" in
+  xvfb)
+    Xvfb $DPY -screen 0 $SIZE +extension Composite -nolisten tcp \
+      >/dev/null 2>&1 &
+    ;;
+  xorg)
+    Xorg $DPY -noreset -nolisten tcp -config \
+      ${AOSD_BENCH_XORG_CONF:-xorg-dummy.conf} >/dev/null 2>&1 &
+    ;;
+  *)
+    echo "$0: unknown server $AOSD_BENCH_SERVER" >&2
+    exit 1
+    ;;
+esac
+SERVER=$!
+trap 'kill $COMPOSITOR $SERVER 2>/dev/null' EXIT INT TERM
+
+export DISPLAY=$DPY
+for i in 1 2 3 4 5 6 7 8 9 10; do
+  xdpyinfo >/dev/null 2>&1 && break
+  sleep 0.5
+done
+
+COMPOSITOR=
+if [ -n "$AOSD_BENCH_COMPOSITOR" ]; then
+  $AOSD_BENCH_COMPOSITOR >/dev/null 2>&1 &
+  COMPOSITOR=$!
+  sleep 1
+fi
+
+"$@"
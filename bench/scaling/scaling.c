@@ -0,0 +1,118 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * Memory and creation latency of many OSDs, each on a connection of its
+ * own versus all of them in one AosdContext.  Meant to be run against
+ * Xvfb:
+ *
+ *   xvfb-run -s "-screen 0 1920x1080x24" ./scaling
+ *
+ * The X server only accepts a limited number of clients (256 by default),
+ * so the per-connection runs stop short of the larger counts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <aosd.h>
+
+static double
+now_ms(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* resident set size in KiB */
+static long
+rss_kb(void)
+{
+  char line[128];
+  long kb = -1;
+  FILE* f = fopen("/proc/self/status", "r");
+
+  if (f == NULL)
+    return -1;
+
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (strncmp(line, "VmRSS:", 6) == 0)
+    {
+      kb = atol(line + 6);
+      break;
+    }
+
+  fclose(f);
+  return kb;
+}
+
+static void
+run(int count, int shared)
+{
+  AosdContext* ctx = NULL;
+  Aosd** osds = calloc(count, sizeof(Aosd*));
+  int i, created = 0;
+  long rss;
+  double start, elapsed;
+
+  rss = rss_kb();
+  start = now_ms();
+
+  if (shared)
+    ctx = aosd_context_new(NULL);
+
+  for (i = 0; i < count; i++)
+  {
+    osds[i] = shared ? aosd_new_in_context(ctx, -1) : aosd_new();
+    if (osds[i] == NULL)
+      break;
+
+    aosd_set_geometry(osds[i], 10 * (i % 100), 10 * (i / 100), 200, 40);
+    created++;
+  }
+
+  /* count the server's side of the work too, one connection is enough
+   * when they're shared */
+  for (i = 0; i < created; i++)
+  {
+    aosd_sync(osds[i]);
+    if (shared)
+      break;
+  }
+
+  elapsed = now_ms() - start;
+  rss = rss_kb() - rss;
+
+  printf("%-8s %6d %8d %10.2f %10.3f %10ld %10.1f\n",
+      shared ? "shared" : "private", count, created, elapsed,
+      created ? elapsed / created : 0.0,
+      rss, created ? (double)rss / created : 0.0);
+
+  if (shared)
+    aosd_context_destroy(ctx);
+  else
+    for (i = 0; i < created; i++)
+      aosd_destroy(osds[i]);
+
+  free(osds);
+}
+
+int main(void)
+{
+  const int counts[] = { 1, 10, 100, 1000 };
+  int i;
+
+  printf("%-8s %6s %8s %10s %10s %10s %10s\n",
+      "conn", "osds", "created", "ms", "ms/osd", "rss KiB", "KiB/osd");
+
+  for (i = 0; i < 4; i++)
+  {
+    run(counts[i], 0);
+    run(counts[i], 1);
+  }
+
+  return 0;
+}
+
+/* vim: set ts=2 sw=2 et : */
@@ -0,0 +1,117 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * Throughput of pango_layout_set_text_aosd() on multi-line text of a
+ * few kilobytes, the way an OSD following a log gets it, next to plain
+ * pango_layout_set_text() on the same input; the difference is what
+ * the newline conversion costs.  Needs no display:
+ *
+ *   ./text [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <aosd-text.h>
+
+static double
+now_ms(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* log-like lines with a bit of non-ASCII in them, up to size bytes */
+static char*
+make_text(size_t size, int* lines)
+{
+  static const char* words[] =
+  {
+    "kernel:", "eth0", "link", "up", "1000Mbps", "déjà", "vu", "—",
+    "Überprüfung", "ok", "temp", "42°C", "fan", "retry", "→", "done",
+  };
+  char* text = malloc(size + 1);
+  const char* word;
+  size_t len = 0, n;
+  int i = 0, col = 0;
+
+  *lines = 0;
+  while (len < size)
+  {
+    if (col > 72)
+    {
+      text[len++] = '\n';
+      (*lines)++;
+      col = 0;
+      continue;
+    }
+
+    word = words[i++ % 16];
+    n = strlen(word);
+    if (len + n + 1 > size)
+      break;
+    memcpy(text + len, word, n);
+    len += n;
+    text[len++] = ' ';
+    col += n + 1;
+  }
+  text[len] = '\0';
+
+  return text;
+}
+
+static void
+run(PangoLayout* lay, size_t size, int iterations)
+{
+  int lines, i;
+  char* text = make_text(size, &lines);
+  size_t len = strlen(text);
+  double start, plain, aosd;
+
+  /* the big inputs get a fraction of the count, but at least one go */
+  if (iterations < 1)
+    iterations = 1;
+
+  start = now_ms();
+  for (i = 0; i < iterations; i++)
+    pango_layout_set_text(lay, text, len);
+  plain = now_ms() - start;
+
+  start = now_ms();
+  for (i = 0; i < iterations; i++)
+    pango_layout_set_text_aosd(lay, text);
+  aosd = now_ms() - start;
+
+  printf("%8zu %6d %10.3f %10.3f %10.3f %10.1f\n",
+      len, lines, plain * 1000.0 / iterations, aosd * 1000.0 / iterations,
+      (aosd - plain) * 1000.0 / iterations,
+      len * (double)iterations / (aosd * 1000.0));
+
+  free(text);
+}
+
+int main(int argc, char* argv[])
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 20000;
+  PangoLayout* lay;
+
+  if (iterations <= 0)
+    iterations = 20000;
+
+  lay = pango_layout_new_aosd();
+
+  printf("%8s %6s %10s %10s %10s %10s\n",
+      "bytes", "lines", "plain us", "aosd us", "convert us", "MB/s");
+
+  run(lay, 1024, iterations);
+  run(lay, 4096, iterations);
+  run(lay, 16384, iterations / 4);
+  run(lay, 65536, iterations / 16);
+
+  pango_layout_unref_aosd(lay);
+  return 0;
+}
+
+/* vim: set ts=2 sw=2 et : */
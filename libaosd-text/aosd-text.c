@@ -5,16 +5,136 @@
 
 #include <string.h>
 #include <stdlib.h>
-#include <wchar.h>
-#include <locale.h>
 
 #include "aosd-text.h"
 
+/* one font map and PangoContext per thread, screen and resolution,
+ * shared by all the layouts made for them; each layout holds a
+ * reference, the last one to go takes the context along.  neither
+ * PangoContext nor, since Pango 1.32.6, the default font map may be
+ * used from another thread than the one that made them */
+typedef struct _TextContext TextContext;
+
+struct _TextContext
+{
+  TextContext* next;
+  GThread* thread;
+  int screen;
+  double dpi;
+  PangoFontMap* font_map;
+  PangoContext* context;
+  /* fonts resolved for interned descriptions, kept loaded */
+  GHashTable* fonts;
+  unsigned refs;
+};
+
+#define TEXT_CONTEXT_KEY "aosd-text-context"
+
+static TextContext* text_contexts;
+G_LOCK_DEFINE_STATIC(text_contexts);
+
+static TextContext*
+text_context_ref(int screen, double dpi)
+{
+  TextContext* tc;
+  PangoFontMap* font_map = NULL;
+  GThread* thread = g_thread_self();
+
+  if (dpi < 0)
+    dpi = 0;
+
+  G_LOCK(text_contexts);
+
+  for (tc = text_contexts; tc != NULL; tc = tc->next)
+  {
+    if (tc->thread != thread)
+      continue;
+
+    if (tc->screen == screen && tc->dpi == dpi)
+    {
+      tc->refs++;
+      G_UNLOCK(text_contexts);
+      return tc;
+    }
+
+    /* other screens at the same resolution can share the fonts */
+    if (tc->dpi == dpi)
+      font_map = tc->font_map;
+  }
+
+  if (font_map != NULL)
+    g_object_ref(font_map);
+  else if (dpi == 0)
+    font_map = g_object_ref(pango_cairo_font_map_get_default());
+  else
+  {
+    font_map = pango_cairo_font_map_new();
+    pango_cairo_font_map_set_resolution(PANGO_CAIRO_FONT_MAP(font_map), dpi);
+  }
+
+  tc = calloc(1, sizeof(TextContext));
+  tc->thread = thread;
+  tc->screen = screen;
+  tc->dpi = dpi;
+  tc->font_map = font_map;
+  tc->context = pango_cairo_font_map_create_context(
+      PANGO_CAIRO_FONT_MAP(font_map));
+  tc->fonts = g_hash_table_new_full(
+      (GHashFunc)pango_font_description_hash,
+      (GEqualFunc)pango_font_description_equal, NULL, g_object_unref);
+  tc->refs = 1;
+  tc->next = text_contexts;
+  text_contexts = tc;
+
+  G_UNLOCK(text_contexts);
+  return tc;
+}
+
+static void
+text_context_unref(gpointer data)
+{
+  TextContext *tc = data, **link;
+
+  G_LOCK(text_contexts);
+
+  if (--tc->refs > 0)
+  {
+    G_UNLOCK(text_contexts);
+    return;
+  }
+
+  for (link = &text_contexts; *link != NULL; link = &(*link)->next)
+    if (*link == tc)
+    {
+      *link = tc->next;
+      break;
+    }
+
+  G_UNLOCK(text_contexts);
+
+  g_hash_table_destroy(tc->fonts);
+  g_object_unref(tc->context);
+  g_object_unref(tc->font_map);
+  free(tc);
+}
+
+PangoLayout*
+pango_layout_new_aosd_for_screen(int screen, double dpi)
+{
+  TextContext* tc = text_context_ref(screen, dpi);
+  PangoLayout* lay = pango_layout_new(tc->context);
+
+  /* dropped whenever the layout goes, however it's unreffed */
+  g_object_set_data_full(G_OBJECT(lay), TEXT_CONTEXT_KEY,
+      tc, text_context_unref);
+
+  return lay;
+}
+
 PangoLayout*
 pango_layout_new_aosd()
 {
-  return pango_layout_new(pango_cairo_font_map_create_context(
-        PANGO_CAIRO_FONT_MAP(pango_cairo_font_map_get_default())));
+  return pango_layout_new_aosd_for_screen(-1, 0);
 }
 
 void
@@ -23,7 +143,9 @@ pango_layout_unref_aosd(PangoLayout* lay)
   if (lay == NULL)
     return;
 
-  g_object_unref(pango_layout_get_context(lay));
+  /* a layout with a context of its own, as we used to make them */
+  if (g_object_get_data(G_OBJECT(lay), TEXT_CONTEXT_KEY) == NULL)
+    g_object_unref(pango_layout_get_context(lay));
   g_object_unref(lay);
 }
 
@@ -45,65 +167,102 @@ pango_layout_get_size_aosd(PangoLayout* lay,
     *lbearing = -ink.x;
 }
 
-void
-pango_layout_set_text_aosd(PangoLayout* lay, const char* text)
+/* scratch space for the converted text, kept with the layout it was
+ * last used for; Pango copies the text, so it's free again right away */
+typedef struct
 {
-  if (lay == NULL || text == NULL)
-    return;
+  char* data;
+  size_t size;
+} TextBuffer;
 
-  size_t len = 0;
-  gboolean good = FALSE;
+#define TEXT_BUFFER_KEY "aosd-text-buffer"
 
-  if (strchr(text, '\n') == NULL)
-    goto bailout;
+static void
+text_buffer_free(gpointer data)
+{
+  TextBuffer* buf = data;
 
-  char* locale = setlocale(LC_ALL, NULL);
-  setlocale(LC_ALL, "en_US.UTF-8");
+  free(buf->data);
+  free(buf);
+}
 
-  if ((len = mbstowcs(NULL, text, 0)) == -1)
-    goto failed;
+static gboolean
+text_buffer_reserve(TextBuffer* buf, size_t size)
+{
+  char* data;
 
-  len++;
-  char* lf = "\n";
-  char* nl = " "; // U+2028, i.e. newline
+  if (size <= buf->size)
+    return TRUE;
 
-  wchar_t wlf, wnl;
+  if (size < 2 * buf->size)
+    size = 2 * buf->size;
 
-  if (mbtowc(&wlf, lf, strlen(lf)) == -1)
-    goto failed;
-  if (mbtowc(&wnl, nl, strlen(nl)) == -1)
-    goto failed;
+  if ((data = realloc(buf->data, size)) == NULL)
+    return FALSE;
+
+  buf->data = data;
+  buf->size = size;
+  return TRUE;
+}
+
+static TextBuffer*
+text_buffer_get(PangoLayout* lay)
+{
+  TextBuffer* buf = g_object_get_data(G_OBJECT(lay), TEXT_BUFFER_KEY);
+
+  if (buf == NULL && (buf = calloc(1, sizeof(TextBuffer))) != NULL)
+    g_object_set_data_full(G_OBJECT(lay), TEXT_BUFFER_KEY,
+        buf, text_buffer_free);
+
+  return buf;
+}
 
-  wchar_t* string = calloc(1, len * sizeof(wchar_t));
-  wchar_t* ptr;
+void
+pango_layout_set_text_aosd(PangoLayout* lay, const char* text)
+{
+  if (lay == NULL || text == NULL)
+    return;
+
+  size_t len = strlen(text), used = 0, n;
+  const char *p = text, *end = text + len;
+  const char* lf = memchr(text, '\n', len);
+  TextBuffer* buf;
+
+  if (lf == NULL || (buf = text_buffer_get(lay)) == NULL)
+  {
+    pango_layout_set_text(lay, text, len);
+    return;
+  }
 
-  if (mbstowcs(string, text, len) == -1)
-    goto free_up;
+  /* a '\n' byte is never part of a longer UTF-8 sequence, so it can be
+   * swapped for U+2028 (line separator) without decoding anything */
+  while (lf != NULL)
+  {
+    n = lf - p;
+    if (!text_buffer_reserve(buf, used + n + 3 + (end - lf)))
+      goto failed;
 
-  while ((ptr = wcschr(string, wlf)) != NULL)
-    *ptr = wnl;
+    memcpy(buf->data + used, p, n);
+    memcpy(buf->data + used + n, "\xe2\x80\xa8", 3);
+    used += n + 3;
 
-  if ((len = wcstombs(NULL, string, 0)) == -1)
-    goto free_up;
+    p = lf + 1;
+    lf = memchr(p, '\n', end - p);
+  }
 
-  len++;
-  char* newstr = calloc(1, len * sizeof(char));
+  n = end - p;
+  if (!text_buffer_reserve(buf, used + n + 1))
+    goto failed;
 
-  if (wcstombs(newstr, string, len) == -1)
-    goto free_up2;
+  memcpy(buf->data + used, p, n);
+  used += n;
+  buf->data[used] = '\0';
 
-  good = TRUE;
-  pango_layout_set_text(lay, newstr, -1);
+  pango_layout_set_text(lay, buf->data, used);
+  return;
 
-free_up2:
-  free(newstr);
-free_up:
-  free(string);
 failed:
-  setlocale(LC_ALL, locale);
-bailout:
-  if (!good)
-    pango_layout_set_text(lay, text, -1);
+  pango_layout_set_text(lay, text, len);
 }
 
 void
@@ -122,14 +281,72 @@ pango_layout_set_attr_aosd(PangoLayout* lay, PangoAttribute* attr)
   pango_layout_set_attributes(lay, attrs);
 }
 
+/* font strings parsed once for the whole process, into descriptions
+ * that are shared and never freed; past the limit they're parsed every
+ * time again */
+#define FONT_CACHE_MAX 256
+
+static GHashTable* font_cache;
+G_LOCK_DEFINE_STATIC(font_cache);
+
+static const PangoFontDescription*
+font_intern(const char* font_desc)
+{
+  PangoFontDescription* desc;
+
+  G_LOCK(font_cache);
+
+  if (font_cache == NULL)
+    font_cache = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+  desc = g_hash_table_lookup(font_cache, font_desc);
+  if (desc == NULL && g_hash_table_size(font_cache) < FONT_CACHE_MAX)
+  {
+    desc = pango_font_description_from_string(font_desc);
+    g_hash_table_insert(font_cache, strdup(font_desc), desc);
+  }
+
+  G_UNLOCK(font_cache);
+  return desc;
+}
+
+/* the first layout of a context to use a font has it matched and
+ * loaded.  layouts still go through the font map themselves, holding a
+ * reference only keeps the font map's and fontconfig's caches warm for
+ * the rest, however the description was spelled.  the context is this
+ * thread's own, so no lock is needed, nor held while fontconfig works */
+static void
+text_context_load_font(TextContext* tc, const PangoFontDescription* desc)
+{
+  PangoFont* font;
+
+  if (g_hash_table_lookup(tc->fonts, desc) == NULL &&
+      (font = pango_context_load_font(tc->context, desc)) != NULL)
+    g_hash_table_insert(tc->fonts, (gpointer)desc, font);
+}
+
 void
 pango_layout_set_font_aosd(PangoLayout* lay, const char* font_desc)
 {
   if (lay == NULL || font_desc == NULL)
     return;
 
-  pango_layout_set_font_description(lay,
-      pango_font_description_from_string(font_desc));
+  const PangoFontDescription* desc = font_intern(font_desc);
+  TextContext* tc;
+
+  if (desc == NULL)
+  {
+    PangoFontDescription* parsed =
+      pango_font_description_from_string(font_desc);
+    pango_layout_set_font_description(lay, parsed);
+    pango_font_description_free(parsed);
+    return;
+  }
+
+  if ((tc = g_object_get_data(G_OBJECT(lay), TEXT_CONTEXT_KEY)) != NULL)
+    text_context_load_font(tc, desc);
+
+  pango_layout_set_font_description(lay, desc);
 }
 
 static gboolean
@@ -162,114 +379,521 @@ filter_for_fg(PangoAttribute* attr, gpointer data)
   }
 }
 
-void
-aosd_text_renderer(cairo_t* cr, void* TextRenderData_ptr)
+/* a copy of the layout with only the attributes filter keeps, leaving
+ * the original alone */
+static PangoLayout*
+filtered_copy(PangoLayout* lay, PangoAttrFilterFunc filter)
 {
-  if (cr == NULL || TextRenderData_ptr == NULL)
-    return;
+  PangoLayout* copy = pango_layout_copy(lay);
+  PangoAttrList* attrs =
+    pango_attr_list_filter(pango_layout_get_attributes(copy), filter, NULL);
 
-  TextRenderData* data = TextRenderData_ptr;
-  PangoLayout* lay = NULL;
-  PangoAttrList* attrs = pango_layout_get_attributes(data->lay);
-  PangoAttrList* new_attrs = NULL;
-  PangoColor col = {0, 0, 0};
+  pango_layout_set_attributes(copy, attrs);
+  if (attrs != NULL)
+    pango_attr_list_unref(attrs);
 
-  // Draw background
+  return copy;
+}
+
+static gboolean
+has_shadow(TextRenderData* data)
+{
+  return data->shadow.opacity != 0 &&
+    (data->shadow.x_offset != 0 || data->shadow.y_offset != 0);
+}
+
+static void
+shadow_origin(TextRenderData* data, int* x, int* y)
+{
+  *x = data->geom.x_offset + data->lbearing;
+  *y = data->geom.y_offset;
+  if (data->fore.opacity != 0)
+  {
+    *x += (data->shadow.x_offset > 0 ? data->shadow.x_offset : 0);
+    *y += (data->shadow.y_offset > 0 ? data->shadow.y_offset : 0);
+  }
+}
+
+static void
+fore_origin(TextRenderData* data, int* x, int* y)
+{
+  *x = data->geom.x_offset + data->lbearing;
+  *y = data->geom.y_offset;
+  if (has_shadow(data))
+  {
+    *x += (data->shadow.x_offset < 0 ? -data->shadow.x_offset : 0);
+    *y += (data->shadow.y_offset < 0 ? -data->shadow.y_offset : 0);
+  }
+}
+
+static void
+set_source_color(cairo_t* cr, const PangoColor* col, guint8 opacity)
+{
+  cairo_set_source_rgba(cr,
+      col->red   / (double)65535,
+      col->green / (double)65535,
+      col->blue  / (double)65535,
+      opacity / (double)255);
+}
+
+static void
+draw_background(cairo_t* cr, TextRenderData* data, const PangoColor* back)
+{
   if (data->back.color != NULL && data->back.opacity != 0)
   {
-    pango_color_parse(&col, data->back.color);
     cairo_set_source_rgb(cr,
-        col.red   / (double)65535,
-        col.green / (double)65535,
-        col.blue  / (double)65535);
+        back->red   / (double)65535,
+        back->green / (double)65535,
+        back->blue  / (double)65535);
     cairo_paint_with_alpha(cr, data->back.opacity / (double)255);
-
-    col = (PangoColor){0, 0, 0};
   }
+}
+
+static void
+draw_text(cairo_t* cr, TextRenderData* data,
+    const PangoColor* back, const PangoColor* shadow, const PangoColor* fore,
+    PangoLayout* shadow_lay, PangoLayout* fore_lay)
+{
+  int x, y;
+
+  // Draw background
+  draw_background(cr, data, back);
 
   // Drop the shadow
-  if (data->shadow.opacity != 0 &&
-      (data->shadow.x_offset != 0 || data->shadow.y_offset != 0))
+  if (has_shadow(data))
   {
-    if (attrs != NULL)
+    set_source_color(cr, shadow, data->shadow.opacity);
+    shadow_origin(data, &x, &y);
+    cairo_move_to(cr, x, y);
+    pango_cairo_show_layout(cr, shadow_lay);
+  }
+
+  // And finally the foreground
+  if (data->fore.opacity != 0)
+  {
+    set_source_color(cr, fore, data->fore.opacity);
+    fore_origin(data, &x, &y);
+    cairo_move_to(cr, x, y);
+    pango_cairo_show_layout(cr, fore_lay);
+  }
+}
+
+void
+aosd_text_renderer(cairo_t* cr, void* TextRenderData_ptr)
+{
+  if (cr == NULL || TextRenderData_ptr == NULL)
+    return;
+
+  TextRenderData* data = TextRenderData_ptr;
+  PangoLayout* shadow_lay = data->lay;
+  PangoLayout* fore_lay = data->lay;
+  PangoColor back = {0, 0, 0}, shadow = {0, 0, 0}, fore = {0, 0, 0};
+
+  if (data->back.color != NULL)
+    pango_color_parse(&back, data->back.color);
+  if (data->shadow.color != NULL)
+    pango_color_parse(&shadow, data->shadow.color);
+  if (data->fore.color != NULL)
+    pango_color_parse(&fore, data->fore.color);
+
+  // Colour attributes would paint over ours
+  if (pango_layout_get_attributes(data->lay) != NULL)
+  {
+    if (has_shadow(data))
+      shadow_lay = filtered_copy(data->lay, filter_for_bg);
+    if (data->fore.opacity != 0)
+      fore_lay = filtered_copy(data->lay, filter_for_fg);
+  }
+
+  draw_text(cr, data, &back, &shadow, &fore, shadow_lay, fore_lay);
+
+  if (shadow_lay != data->lay)
+    g_object_unref(shadow_lay);
+  if (fore_lay != data->lay)
+    g_object_unref(fore_lay);
+}
+
+/* a shadow blurred by radius takes passes of about radius / 3, and
+ * their rounding would wrap a full 255 over to 0 from 129 on */
+#define SHADOW_BLUR_MAX 255
+
+/* one pass of a box blur along the rows, zero beyond the edges */
+static void
+box_blur_rows(unsigned char* dst, const unsigned char* src,
+    int width, int height, int stride, int r)
+{
+  unsigned mul = (65536 + r) / (2 * r + 1);
+  unsigned sum;
+  int x, y;
+
+  for (y = 0; y < height; y++)
+  {
+    const unsigned char* in = src + y * stride;
+    unsigned char* out = dst + y * stride;
+
+    for (sum = 0, x = 0; x < r && x < width; x++)
+      sum += in[x];
+
+    for (x = 0; x < width; x++)
     {
-      lay = pango_layout_copy(data->lay);
-      new_attrs = pango_attr_list_filter(attrs, filter_for_bg, NULL);
-      pango_layout_set_attributes(lay, new_attrs);
+      if (x + r < width)
+        sum += in[x + r];
+      out[x] = (sum * mul + 32768) >> 16;
+      if (x - r >= 0)
+        sum -= in[x - r];
     }
-    else
-      lay = data->lay;
-
-    if (data->shadow.color != NULL)
-      pango_color_parse(&col, data->shadow.color);
-    cairo_set_source_rgba(cr,
-        col.red     / (double)65535,
-        col.green   / (double)65535,
-        col.blue    / (double)65535,
-        data->shadow.opacity / (double)255);
-
-    int x = data->geom.x_offset + data->lbearing;
-    int y = data->geom.y_offset;
-    if (data->fore.opacity != 0)
+  }
+}
+
+/* a row's worth of column sums, added to or taken from; blocks of a
+ * fixed 16 columns are what the compiler vectorizes at -O2 */
+static void
+add_row(unsigned* restrict sum, const unsigned char* restrict in, int width)
+{
+  int x, i;
+
+  for (x = 0; x + 16 <= width; x += 16)
+    for (i = 0; i < 16; i++)
+      sum[x + i] += in[x + i];
+  for (; x < width; x++)
+    sum[x] += in[x];
+}
+
+static void
+sub_row(unsigned* restrict sum, const unsigned char* restrict in, int width)
+{
+  int x, i;
+
+  for (x = 0; x + 16 <= width; x += 16)
+    for (i = 0; i < 16; i++)
+      sum[x + i] -= in[x + i];
+  for (; x < width; x++)
+    sum[x] -= in[x];
+}
+
+static void
+scale_row(unsigned char* restrict out, const unsigned* restrict sum,
+    int width, unsigned mul)
+{
+  int x, i;
+
+  for (x = 0; x + 16 <= width; x += 16)
+    for (i = 0; i < 16; i++)
+      out[x + i] = (sum[x + i] * mul + 32768) >> 16;
+  for (; x < width; x++)
+    out[x] = (sum[x] * mul + 32768) >> 16;
+}
+
+/* and down the columns, a whole row at a time */
+static void
+box_blur_columns(unsigned char* dst, const unsigned char* src,
+    int width, int height, int stride, int r, unsigned* sum)
+{
+  unsigned mul = (65536 + r) / (2 * r + 1);
+  int y;
+
+  memset(sum, 0, width * sizeof(unsigned));
+  for (y = 0; y < r && y < height; y++)
+    add_row(sum, src + y * stride, width);
+
+  for (y = 0; y < height; y++)
+  {
+    if (y + r < height)
+      add_row(sum, src + (y + r) * stride, width);
+    scale_row(dst + y * stride, sum, width, mul);
+    if (y - r >= 0)
+      sub_row(sum, src + (y - r) * stride, width);
+  }
+}
+
+/* three box passes of radius r, close enough to a gaussian; the data
+ * needs 3 * r pixels of room around what it blurs */
+static void
+blur_a8(unsigned char* data, int width, int height, int stride, int r)
+{
+  unsigned char* tmp = malloc(stride * height);
+  unsigned* sum = malloc(width * sizeof(unsigned));
+  int i;
+
+  if (tmp != NULL && sum != NULL)
+    for (i = 0; i < 3; i++)
     {
-      x += (data->shadow.x_offset > 0 ? data->shadow.x_offset : 0);
-      y += (data->shadow.y_offset > 0 ? data->shadow.y_offset : 0);
+      box_blur_rows(tmp, data, width, height, stride, r);
+      box_blur_columns(data, tmp, width, height, stride, r, sum);
     }
-    cairo_move_to(cr, x, y);
 
-    pango_cairo_show_layout(cr, lay);
+  free(sum);
+  free(tmp);
+}
 
-    if (new_attrs != NULL)
-      pango_attr_list_unref(new_attrs);
-    if (attrs != NULL)
-      g_object_unref(lay);
+/* what the layout draws, as an A8 mask with pad pixels all around;
+ * x and y are where the mask goes relative to the layout's origin */
+static cairo_surface_t*
+make_mask(PangoLayout* lay, int pad, int* x, int* y)
+{
+  PangoRectangle ink;
+  cairo_surface_t* mask;
+  cairo_t* cr;
+
+  pango_layout_get_pixel_extents(lay, &ink, NULL);
+  if (ink.width <= 0 || ink.height <= 0)
+    return NULL;
 
-    lay = NULL;
-    new_attrs = NULL;
-    col = (PangoColor){0, 0, 0};
+  mask = cairo_image_surface_create(CAIRO_FORMAT_A8,
+      ink.width + 2 * pad, ink.height + 2 * pad);
+  if (cairo_surface_status(mask) != CAIRO_STATUS_SUCCESS)
+  {
+    cairo_surface_destroy(mask);
+    return NULL;
   }
 
-  // And finally the foreground
-  if (data->fore.opacity != 0)
+  cr = cairo_create(mask);
+  cairo_move_to(cr, pad - ink.x, pad - ink.y);
+  pango_cairo_show_layout(cr, lay);
+  cairo_destroy(cr);
+  cairo_surface_flush(mask);
+
+  *x = ink.x - pad;
+  *y = ink.y - pad;
+  return mask;
+}
+
+static gboolean
+find_line_color(PangoAttribute* attr, gpointer data)
+{
+  if (attr->klass->type == PANGO_ATTR_UNDERLINE_COLOR ||
+      attr->klass->type == PANGO_ATTR_STRIKETHROUGH_COLOR)
+    *(gboolean*)data = TRUE;
+
+  /* look, don't take */
+  return FALSE;
+}
+
+typedef struct
+{
+  char* spec;
+  PangoColor color;
+} PreparedColor;
+
+struct _PreparedText
+{
+  TextRenderData* trd;
+  /* the layout the filtered copies were made from, and its serial then */
+  PangoLayout* source;
+  guint serial;
+  /* NULL while the layout has no attributes to filter */
+  PangoLayout* shadow_lay;
+  PangoLayout* fore_lay;
+  PreparedColor back, shadow, fore;
+
+  /* the text rasterized once, composited for the shadow and, unless it
+   * has lines of other colours in it, the foreground */
+  cairo_surface_t* mask;
+  int mask_x, mask_y;
+  gboolean fore_from_mask;
+  /* the blurred copy for a soft shadow, and the radius it was made for */
+  unsigned blur;
+  cairo_surface_t* soft_mask;
+  unsigned soft_blur;
+  int soft_x, soft_y;
+};
+
+/* parses the colour again only if it's a different one */
+static const PangoColor*
+prepared_color(PreparedColor* pc, const char* spec)
+{
+  if (spec == NULL)
   {
+    free(pc->spec);
+    pc->spec = NULL;
+    pc->color = (PangoColor){0, 0, 0};
+  }
+  else if (pc->spec == NULL || strcmp(pc->spec, spec) != 0)
+  {
+    free(pc->spec);
+    pc->spec = strdup(spec);
+    pc->color = (PangoColor){0, 0, 0};
+    pango_color_parse(&pc->color, spec);
+  }
+
+  return &pc->color;
+}
+
+static void
+prepared_drop_soft_mask(PreparedText* prep)
+{
+  if (prep->soft_mask != NULL)
+    cairo_surface_destroy(prep->soft_mask);
+  prep->soft_mask = NULL;
+}
+
+static void
+prepared_drop_layouts(PreparedText* prep)
+{
+  if (prep->shadow_lay != NULL)
+    g_object_unref(prep->shadow_lay);
+  if (prep->fore_lay != NULL)
+    g_object_unref(prep->fore_lay);
+  if (prep->mask != NULL)
+    cairo_surface_destroy(prep->mask);
+  prepared_drop_soft_mask(prep);
+
+  prep->shadow_lay = prep->fore_lay = NULL;
+  prep->mask = NULL;
+  prep->source = NULL;
+}
+
+static PangoLayout*
+shadow_lay(PreparedText* prep)
+{
+  return prep->shadow_lay != NULL ? prep->shadow_lay : prep->trd->lay;
+}
+
+/* the shadow's mask, blurred if it's to be soft */
+static cairo_surface_t*
+prepared_shadow_mask(PreparedText* prep, PangoLayout* lay, int* x, int* y)
+{
+  /* three passes, each a third of the radius */
+  int r = (prep->blur + 2) / 3;
+
+  if (prep->blur == 0)
+  {
+    *x = prep->mask_x;
+    *y = prep->mask_y;
+    return prep->mask;
+  }
+
+  if (prep->soft_mask == NULL || prep->soft_blur != prep->blur)
+  {
+    prepared_drop_soft_mask(prep);
+
+    prep->soft_mask = make_mask(lay, 3 * r + 1, &prep->soft_x, &prep->soft_y);
+    if (prep->soft_mask == NULL)
+      return NULL;
+
+    blur_a8(cairo_image_surface_get_data(prep->soft_mask),
+        cairo_image_surface_get_width(prep->soft_mask),
+        cairo_image_surface_get_height(prep->soft_mask),
+        cairo_image_surface_get_stride(prep->soft_mask), r);
+    cairo_surface_mark_dirty(prep->soft_mask);
+    prep->soft_blur = prep->blur;
+  }
+
+  *x = prep->soft_x;
+  *y = prep->soft_y;
+  return prep->soft_mask;
+}
+
+PreparedText*
+aosd_text_prepare(TextRenderData* trd)
+{
+  PreparedText* prep;
+
+  if (trd == NULL)
+    return NULL;
+
+  prep = calloc(1, sizeof(PreparedText));
+  prep->trd = trd;
+
+  return prep;
+}
+
+void
+aosd_text_prepared_free(PreparedText* prep)
+{
+  if (prep == NULL)
+    return;
+
+  prepared_drop_layouts(prep);
+  free(prep->back.spec);
+  free(prep->shadow.spec);
+  free(prep->fore.spec);
+  free(prep);
+}
+
+void
+aosd_text_prepared_renderer(cairo_t* cr, void* PreparedText_ptr)
+{
+  if (cr == NULL || PreparedText_ptr == NULL)
+    return;
+
+  PreparedText* prep = PreparedText_ptr;
+  TextRenderData* data = prep->trd;
+  guint serial;
+
+  if (data->lay == NULL)
+    return;
+
+  /* any change to the layout bumps its serial, text and attributes
+   * included; the copies and the masks are made once and then just
+   * composited */
+  serial = pango_layout_get_serial(data->lay);
+  if (data->lay != prep->source || serial != prep->serial)
+  {
+    PangoAttrList* attrs = pango_layout_get_attributes(data->lay);
+    gboolean lines = FALSE;
+
+    prepared_drop_layouts(prep);
+
     if (attrs != NULL)
     {
-      lay = pango_layout_copy(data->lay);
-      new_attrs = pango_attr_list_filter(attrs, filter_for_fg, NULL);
-      pango_layout_set_attributes(lay, new_attrs);
+      prep->shadow_lay = filtered_copy(data->lay, filter_for_bg);
+      prep->fore_lay = filtered_copy(data->lay, filter_for_fg);
+      pango_attr_list_filter(attrs, find_line_color, &lines);
     }
+
+    /* lines in colours of their own can't come out of a mask */
+    prep->fore_from_mask = !lines;
+    /* a pixel of room for antialiasing past the ink */
+    prep->mask = make_mask(shadow_lay(prep), 1, &prep->mask_x, &prep->mask_y);
+    prep->source = data->lay;
+    prep->serial = serial;
+  }
+
+  const PangoColor* back = prepared_color(&prep->back, data->back.color);
+  const PangoColor* shadow = prepared_color(&prep->shadow, data->shadow.color);
+  const PangoColor* fore = prepared_color(&prep->fore, data->fore.color);
+  cairo_surface_t* mask;
+  int x, y, mx, my;
+
+  if (prep->mask == NULL)
+  {
+    draw_text(cr, data, back, shadow, fore,
+        shadow_lay(prep), prep->fore_lay != NULL ? prep->fore_lay : data->lay);
+    return;
+  }
+
+  draw_background(cr, data, back);
+
+  if (has_shadow(data) &&
+      (mask = prepared_shadow_mask(prep, shadow_lay(prep), &mx, &my)) != NULL)
+  {
+    shadow_origin(data, &x, &y);
+    set_source_color(cr, shadow, data->shadow.opacity);
+    cairo_mask_surface(cr, mask, x + mx, y + my);
+  }
+
+  if (data->fore.opacity != 0)
+  {
+    fore_origin(data, &x, &y);
+    set_source_color(cr, fore, data->fore.opacity);
+    if (prep->fore_from_mask)
+      cairo_mask_surface(cr, prep->mask, x + prep->mask_x, y + prep->mask_y);
     else
-      lay = data->lay;
-
-    if (data->fore.color != NULL)
-      pango_color_parse(&col, data->fore.color);
-    cairo_set_source_rgba(cr,
-        col.red   / (double)65535,
-        col.green / (double)65535,
-        col.blue  / (double)65535,
-        data->fore.opacity / (double)255);
-
-    int x = data->geom.x_offset + data->lbearing;
-    int y = data->geom.y_offset;
-    if (data->shadow.opacity != 0 &&
-        (data->shadow.x_offset != 0 || data->shadow.y_offset != 0))
     {
-      x += (data->shadow.x_offset < 0 ? -data->shadow.x_offset : 0);
-      y += (data->shadow.y_offset < 0 ? -data->shadow.y_offset : 0);
+      cairo_move_to(cr, x, y);
+      pango_cairo_show_layout(cr, prep->fore_lay);
     }
-    cairo_move_to(cr, x, y);
-
-    pango_cairo_show_layout(cr, lay);
+  }
+}
 
-    if (new_attrs != NULL)
-      pango_attr_list_unref(new_attrs);
-    if (attrs != NULL)
-      g_object_unref(lay);
+void
+aosd_text_prepared_set_shadow_blur(PreparedText* prep, unsigned radius)
+{
+  if (prep == NULL)
+    return;
 
-    lay = NULL;
-    new_attrs = NULL;
-    col = (PangoColor){0, 0, 0};
-  }
+  prep->blur = radius < SHADOW_BLUR_MAX ? radius : SHADOW_BLUR_MAX;
 }
 
 void
@@ -320,4 +944,47 @@ aosd_text_get_screen_wrap_width(Aosd* aosd, TextRenderData* trd)
   return width * PANGO_SCALE;
 }
 
+typedef struct
+{
+  TextRenderData* trd;
+  char text[];
+} PostedText;
+
+static void
+posted_text_cb(Aosd* aosd, void* data)
+{
+  PostedText* posted = data;
+
+  pango_layout_set_text_aosd(posted->trd->lay, posted->text);
+
+  /* a retained copy or a flash would go on showing the old text */
+  aosd_invalidate(aosd);
+  if (aosd_get_is_shown(aosd))
+    aosd_render(aosd);
+}
+
+Bool
+aosd_text_post_text(Aosd* aosd, TextRenderData* trd, const char* text)
+{
+  if (aosd == NULL || trd == NULL || text == NULL)
+    return False;
+
+  size_t len = strlen(text) + 1;
+  PostedText* posted = malloc(sizeof(PostedText) + len);
+
+  if (posted == NULL)
+    return False;
+
+  posted->trd = trd;
+  memcpy(posted->text, text, len);
+
+  if (!aosd_post_call(aosd, posted_text_cb, posted, free))
+  {
+    free(posted);
+    return False;
+  }
+
+  return True;
+}
+
 /* vim: set ts=2 sw=2 et : */
@@ -20,10 +20,21 @@ extern "C"
 PangoLayout* pango_layout_new_aosd(void);
 void pango_layout_unref_aosd(PangoLayout* lay);
 
+// Layouts for the same screen (as passed to aosd_new_in_context(), -1
+// for the default one) and resolution (in dpi, 0 for Pango's default)
+// share one font map and context, and so their font and glyph caches.
+// pango_layout_new_aosd() is the default screen at the default resolution.
+// Like Pango's own, the shared context belongs to the thread that made
+// the layout: each thread gets contexts of its own, and a layout has
+// to stay on the thread that made it, so make layouts on the thread
+// that renders them
+PangoLayout* pango_layout_new_aosd_for_screen(int screen, double dpi);
+
 void pango_layout_get_size_aosd(PangoLayout* lay,
     unsigned* width, unsigned* height, int* lbearing);
 
-// Converts all \n occurrences into U+2028 symbol
+// Converts all \n occurrences into U+2028 symbol; takes UTF-8 and
+// doesn't touch the locale, so threads may use it on layouts of their own
 void pango_layout_set_text_aosd(PangoLayout* lay, const char* text);
 void pango_layout_set_attr_aosd(PangoLayout* lay, PangoAttribute* attr);
 void pango_layout_set_font_aosd(PangoLayout* lay, const char* font_desc);
@@ -62,9 +73,32 @@ typedef struct
 } TextRenderData;
 
 void aosd_text_renderer(cairo_t* cr, void* TextRenderData_ptr);
+
+// TextRenderData prepared for rendering frame after frame: the colours
+// are parsed and the layouts filtered for the shadow and the foreground
+// once, and again only when the text, attributes or colours change, so
+// an unchanged frame is just drawn.  Give aosd_set_renderer()
+// aosd_text_prepared_renderer and the PreparedText; the TextRenderData
+// has to outlive it
+typedef struct _PreparedText PreparedText;
+
+PreparedText* aosd_text_prepare(TextRenderData* trd);
+void aosd_text_prepared_free(PreparedText* prep);
+void aosd_text_prepared_renderer(cairo_t* cr, void* PreparedText_ptr);
+
+// Prepared text is rasterized once into a mask, which is then painted
+// in the shadow's colour and in the foreground's.  A soft shadow blurs
+// that mask by about radius pixels, 0 (the default) for a hard one, up
+// to 255; it spreads past what aosd_text_get_size() counts, so leave
+// room for it
+void aosd_text_prepared_set_shadow_blur(PreparedText* prep, unsigned radius);
 void aosd_text_get_size(TextRenderData* trd, unsigned* width, unsigned* height);
 int aosd_text_get_screen_wrap_width(Aosd* aosd, TextRenderData* trd);
 
+// Thread-safe: copies the text and has the OSD's own thread put it in
+// trd->lay and re-render, see aosd_post_call()
+Bool aosd_text_post_text(Aosd* aosd, TextRenderData* trd, const char* text);
+
 #ifdef __cplusplus
 }
 #endif
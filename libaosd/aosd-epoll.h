@@ -0,0 +1,122 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * epoll adapter, drives any number of OSDs from an existing epoll loop:
+ *
+ *   aosd_epoll_add(epfd, aosd);        // event data is the Aosd*,
+ *                                      // for both fds it watches
+ *   ...
+ *   timeout = aosd_epoll_prepare(osds, n, timeout);
+ *   n_ready = epoll_wait(epfd, events, max_events, timeout);
+ *   aosd_epoll_dispatch(osds, n);
+ *
+ * OSDs in one AosdContext share a connection, so register the context
+ * once with aosd_epoll_add_context() and drive it with the
+ * aosd_context_*() calls instead.
+ *
+ * Header-only, like aosd-glib.h.
+ */
+
+#ifndef __AOSD_EPOLL_H__
+#define __AOSD_EPOLL_H__
+
+#include <sys/epoll.h>
+
+#include <aosd.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+static inline int
+aosd_epoll_add(int epfd, Aosd* aosd)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = aosd;
+
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, aosd_get_queue_fd(aosd), &ev) < 0)
+    return -1;
+
+  /* headless OSDs have nothing but the queue */
+  if (aosd_get_fd(aosd) < 0)
+    return 0;
+
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, aosd_get_fd(aosd), &ev);
+}
+
+static inline int
+aosd_epoll_del(int epfd, Aosd* aosd)
+{
+  struct epoll_event ev = { 0 };
+
+  if (epoll_ctl(epfd, EPOLL_CTL_DEL, aosd_get_queue_fd(aosd), &ev) < 0)
+    return -1;
+
+  if (aosd_get_fd(aosd) < 0)
+    return 0;
+
+  return epoll_ctl(epfd, EPOLL_CTL_DEL, aosd_get_fd(aosd), &ev);
+}
+
+static inline int
+aosd_epoll_add_context(int epfd, AosdContext* ctx)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = ctx;
+
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, aosd_context_get_queue_fd(ctx), &ev) < 0)
+    return -1;
+
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, aosd_context_get_fd(ctx), &ev);
+}
+
+static inline int
+aosd_epoll_del_context(int epfd, AosdContext* ctx)
+{
+  struct epoll_event ev = { 0 };
+
+  epoll_ctl(epfd, EPOLL_CTL_DEL, aosd_context_get_queue_fd(ctx), &ev);
+  return epoll_ctl(epfd, EPOLL_CTL_DEL, aosd_context_get_fd(ctx), &ev);
+}
+
+/* flushes every OSD and returns the timeout for epoll_wait(),
+ * no later than the one the caller wanted (-1 being infinite) */
+static inline int
+aosd_epoll_prepare(Aosd* const* osds, int n, int timeout)
+{
+  int i, t;
+
+  for (i = 0; i < n; i++)
+  {
+    aosd_flush(osds[i]);
+
+    t = aosd_get_timeout(osds[i]);
+    if (t >= 0 && (timeout < 0 || t < timeout))
+      timeout = t;
+  }
+
+  return timeout;
+}
+
+/* dispatching an OSD that has nothing to do costs a single non-blocking
+ * read, so we don't bother matching them up with the ready events */
+static inline void
+aosd_epoll_dispatch(Aosd* const* osds, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    aosd_dispatch(osds[i]);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AOSD_EPOLL_H__ */
+
+/* vim: set ts=2 sw=2 et : */
@@ -0,0 +1,148 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * GSource adapter, drives an OSD from a GMainContext:
+ *
+ *   GSource* source = aosd_source_new(aosd);
+ *   g_source_attach(source, NULL);
+ *   g_source_unref(source);
+ *
+ * OSDs sharing an AosdContext only need one source between them, made
+ * with aosd_context_source_new().  A display-less OSD gets a source of
+ * its own from aosd_source_new(), woken by posted commands and by its
+ * flash's frame deadlines instead of a connection.
+ *
+ * Header-only, so that libaosd itself doesn't need to link against Glib.
+ */
+
+#ifndef __AOSD_GLIB_H__
+#define __AOSD_GLIB_H__
+
+#include <glib.h>
+
+#include <aosd.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+  GSource source;
+  GPollFD pollfd;
+  GPollFD queue_pollfd;
+  AosdContext* ctx;
+  /* set for a display-less OSD, which has no context */
+  Aosd* aosd;
+} AosdSource;
+
+static inline gboolean
+aosd_source_prepare(GSource* source, gint* timeout)
+{
+  AosdSource* asource = (AosdSource*)source;
+
+  if (asource->aosd != NULL)
+    *timeout = aosd_get_timeout(asource->aosd);
+  else
+  {
+    aosd_context_flush(asource->ctx);
+    *timeout = aosd_context_get_timeout(asource->ctx);
+  }
+
+  return *timeout == 0;
+}
+
+static inline gboolean
+aosd_source_check(GSource* source)
+{
+  AosdSource* asource = (AosdSource*)source;
+
+  if (asource->aosd != NULL)
+    return (asource->queue_pollfd.revents & G_IO_IN) ||
+      aosd_get_timeout(asource->aosd) == 0;
+
+  return (asource->pollfd.revents & G_IO_IN) ||
+    (asource->queue_pollfd.revents & G_IO_IN) ||
+    aosd_context_get_timeout(asource->ctx) == 0;
+}
+
+static inline gboolean
+aosd_source_dispatch(GSource* source, GSourceFunc callback, gpointer user_data)
+{
+  AosdSource* asource = (AosdSource*)source;
+
+  if (asource->aosd != NULL)
+    aosd_dispatch(asource->aosd);
+  else
+    aosd_context_dispatch(asource->ctx);
+
+  /* an optional callback runs after the OSDs had their events */
+  if (callback != NULL)
+    return callback(user_data);
+
+  return TRUE;
+}
+
+static inline GSourceFuncs*
+aosd_source_funcs(void)
+{
+  static GSourceFuncs funcs =
+  {
+    aosd_source_prepare,
+    aosd_source_check,
+    aosd_source_dispatch,
+    NULL, NULL, NULL
+  };
+
+  return &funcs;
+}
+
+/* the context has to outlive the source */
+static inline GSource*
+aosd_context_source_new(AosdContext* ctx)
+{
+  GSource* source = g_source_new(aosd_source_funcs(), sizeof(AosdSource));
+  AosdSource* asource = (AosdSource*)source;
+
+  asource->ctx = ctx;
+  asource->pollfd.fd = aosd_context_get_fd(ctx);
+  asource->pollfd.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+  g_source_add_poll(source, &asource->pollfd);
+
+  /* commands posted from other threads */
+  asource->queue_pollfd.fd = aosd_context_get_queue_fd(ctx);
+  asource->queue_pollfd.events = G_IO_IN;
+  g_source_add_poll(source, &asource->queue_pollfd);
+
+  return source;
+}
+
+/* the OSD has to outlive the source */
+static inline GSource*
+aosd_source_new(Aosd* aosd)
+{
+  AosdContext* ctx = aosd_get_context(aosd);
+  GSource* source;
+  AosdSource* asource;
+
+  if (ctx != NULL)
+    return aosd_context_source_new(ctx);
+
+  /* display-less: nothing to read, only commands and deadlines */
+  source = g_source_new(aosd_source_funcs(), sizeof(AosdSource));
+  asource = (AosdSource*)source;
+  asource->aosd = aosd;
+  asource->queue_pollfd.fd = aosd_get_queue_fd(aosd);
+  asource->queue_pollfd.events = G_IO_IN;
+  g_source_add_poll(source, &asource->queue_pollfd);
+
+  return source;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AOSD_GLIB_H__ */
+
+/* vim: set ts=2 sw=2 et : */
@@ -12,120 +12,2165 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <cairo/cairo-xlib-xrender.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 
-#ifdef HAVE_XCOMPOSITE
-#include <X11/extensions/Xrender.h>
-#include <X11/extensions/Xcomposite.h>
-#endif
+#ifdef HAVE_XCOMPOSITE
+#include <X11/extensions/Xrender.h>
+#include <X11/extensions/Xcomposite.h>
+#endif
+
+#ifdef HAVE_XCB
+#include <cairo/cairo-xcb.h>
+#endif
+
+#include "aosd-internal.h"
+
+#ifdef HAVE_XSYNC
+static void
+set_frame_counter(Aosd* aosd, unsigned long long value)
+{
+  XSyncValue sv;
+
+  XSyncIntsToValue(&sv, value & 0xffffffff, value >> 32);
+  XSyncSetCounter(aosd->display, aosd->pacing.counter[1], sv);
+}
+
+static void
+make_frame_sync(Aosd* aosd)
+{
+  Display* dsp = aosd->display;
+  AosdPacing* pacing = &aosd->pacing;
+  int event_base, error_base, major, minor;
+  XSyncValue zero;
+
+  /* someone else found out it's pointless already */
+  if (get_screen(aosd)->no_frame_drawn)
+  {
+    pacing->frame_sync = False;
+    return;
+  }
+
+  /* back in composite mode after a compositor restart */
+  if (pacing->counter[0] != None)
+  {
+    pacing->frame_sync = True;
+    pacing->missed = 0;
+    return;
+  }
+
+  /* initializing is a round trip, once per connection is plenty */
+  if (!aosd->context->sync_probed)
+  {
+    stats_begin(aosd);
+    aosd->context->sync = False;
+    if (has_extension(aosd->context, EXT_SYNC))
+    {
+      aosd->stats.round_trips++;
+      if (XSyncQueryExtension(dsp, &event_base, &error_base))
+      {
+        aosd->stats.round_trips++;
+        aosd->context->sync = XSyncInitialize(dsp, &major, &minor);
+      }
+    }
+    aosd->context->sync_probed = True;
+    stats_end(aosd);
+  }
+
+  if (!aosd->context->sync)
+    return;
+
+  /* extended _NET_WM_SYNC_REQUEST: the compositor answers every even
+   * counter value with _NET_WM_FRAME_DRAWN once that frame is on screen */
+  XSyncIntToValue(&zero, 0);
+  pacing->counter[0] = XSyncCreateCounter(dsp, zero);
+  pacing->counter[1] = XSyncCreateCounter(dsp, zero);
+  pacing->counter_value = 0;
+
+  Atom* atoms = aosd->context->atoms;
+  XChangeProperty(dsp, aosd->win, atoms[ATOM_NET_WM_SYNC_REQUEST_COUNTER],
+      XA_CARDINAL, 32, PropModeReplace, (unsigned char*)pacing->counter, 2);
+
+  XSetWMProtocols(dsp, aosd->win, &atoms[ATOM_NET_WM_SYNC_REQUEST], 1);
+
+  pacing->frame_sync = True;
+}
+#endif
+
+static void
+make_pacing(Aosd* aosd)
+{
+#ifdef HAVE_XPRESENT
+  AosdPacing* pacing = &aosd->pacing;
+  int event_base, error_base;
+
+  if (has_extension(aosd->context, EXT_PRESENT))
+  {
+    stats_begin(aosd);
+    aosd->stats.round_trips++;
+    if (XPresentQueryExtension(aosd->display,
+          &pacing->present_opcode, &event_base, &error_base))
+    {
+      XPresentSelectInput(aosd->display, aosd->win,
+          PresentCompleteNotifyMask | PresentIdleNotifyMask);
+      pacing->present = True;
+      aosd->context->present_opcode = pacing->present_opcode;
+    }
+    stats_end(aosd);
+  }
+#endif
+
+#ifdef HAVE_XSYNC
+  if (aosd->mode == TRANSPARENCY_COMPOSITE)
+    make_frame_sync(aosd);
+#endif
+}
+
+static void
+free_pacing(Aosd* aosd)
+{
+  AosdPacing* pacing = &aosd->pacing;
+
+#ifdef HAVE_XSYNC
+  /* they outlive frame sync being given up on */
+  if (pacing->counter[0] != None)
+  {
+    XSyncDestroyCounter(aosd->display, pacing->counter[0]);
+    XSyncDestroyCounter(aosd->display, pacing->counter[1]);
+  }
+#endif
+
+  /* nothing is in flight for a window that's gone */
+  memset(pacing, 0, sizeof(AosdPacing));
+  aosd->resources.buffer[0].busy = False;
+  aosd->resources.buffer[1].busy = False;
+}
+
+static const char* atom_names[N_ATOMS] =
+{
+  "_MOTIF_WM_HINTS",
+  "_NET_WM_WINDOW_TYPE",
+  "_NET_WM_WINDOW_TYPE_NOTIFICATION",
+  "_NET_WM_STATE",
+  "_NET_WM_STATE_ABOVE",
+  "_NET_WM_STATE_STICKY",
+  "_NET_WM_STATE_SKIP_TASKBAR",
+  "_NET_WM_STATE_SKIP_PAGER",
+  "_NET_WM_WINDOW_OPACITY",
+  "_NET_WM_SYNC_REQUEST",
+  "_NET_WM_SYNC_REQUEST_COUNTER",
+  "_NET_WM_FRAME_DRAWN",
+  "_XROOTPMAP_ID",
+  "_NET_SUPPORTED"
+};
+
+#ifdef HAVE_XCB
+static const char* extension_names[N_EXTENSIONS] =
+{
+  "Composite",
+  "XFIXES",
+  "DAMAGE",
+  "SYNC",
+  "Present",
+  "MIT-SHM",
+  "RANDR"
+};
+#endif
+
+/* a single round trip for all of them, screens' _NET_WM_CM_Sn included */
+void
+intern_atoms(AosdContext* ctx)
+{
+  int n = N_ATOMS + ctx->n_screens;
+  char** names = malloc(n * sizeof(char*));
+  Atom* atoms = malloc(n * sizeof(Atom));
+  int i;
+
+  for (i = 0; i < N_ATOMS; i++)
+    names[i] = (char*)atom_names[i];
+  for (i = 0; i < ctx->n_screens; i++)
+  {
+    names[N_ATOMS + i] = malloc(32);
+    snprintf(names[N_ATOMS + i], 32, "_NET_WM_CM_S%d", i);
+  }
+
+#ifdef HAVE_XCB
+  xcb_intern_atom_cookie_t* cookies = malloc(n * sizeof(*cookies));
+
+  for (i = 0; i < n; i++)
+    cookies[i] = xcb_intern_atom(ctx->xcb, 0, strlen(names[i]), names[i]);
+
+  /* the extension queries go out in the same batch, but nobody waits
+   * for their replies until the extension is actually needed */
+  for (i = 0; i < N_EXTENSIONS; i++)
+  {
+    ctx->ext_cookie[i] = xcb_query_extension(ctx->xcb,
+        strlen(extension_names[i]), extension_names[i]);
+    ctx->ext_present[i] = -1;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    xcb_intern_atom_reply_t* reply =
+      xcb_intern_atom_reply(ctx->xcb, cookies[i], NULL);
+
+    atoms[i] = (reply != NULL) ? reply->atom : None;
+    free(reply);
+  }
+
+  free(cookies);
+#else
+  XInternAtoms(ctx->display, names, n, False, atoms);
+#endif
+
+  memcpy(ctx->atoms, atoms, N_ATOMS * sizeof(Atom));
+  for (i = 0; i < ctx->n_screens; i++)
+  {
+    ctx->screens[i].cm_atom = atoms[N_ATOMS + i];
+    free(names[N_ATOMS + i]);
+  }
+
+  free(names);
+  free(atoms);
+}
+
+Bool
+has_extension(AosdContext* ctx, AosdExtension ext)
+{
+#ifdef HAVE_XCB
+  if (ctx->ext_present[ext] < 0)
+  {
+    xcb_query_extension_reply_t* reply =
+      xcb_query_extension_reply(ctx->xcb, ctx->ext_cookie[ext], NULL);
+
+    ctx->ext_present[ext] = (reply != NULL && reply->present);
+    free(reply);
+  }
+
+  return ctx->ext_present[ext];
+#else
+  /* no early answers, the extension's library finds out by itself */
+  return True;
+#endif
+}
+
+void
+discard_probes(AosdContext* ctx)
+{
+#ifdef HAVE_XCB
+  int i;
+
+  for (i = 0; i < N_EXTENSIONS; i++)
+    if (ctx->ext_present[i] < 0)
+      xcb_discard_reply(ctx->xcb, ctx->ext_cookie[i].sequence);
+#endif
+}
+
+#if defined(HAVE_XFIXES) && (defined(HAVE_XCOMPOSITE) || defined(HAVE_XDAMAGE))
+/* XFixes requests fail until we told the server which version we speak */
+static Bool
+probe_xfixes(Aosd* aosd)
+{
+  AosdContext* ctx = aosd->context;
+  int event_base, error_base, major = 4, minor = 0;
+
+  if (ctx->xfixes_event == 0)
+  {
+    /* charged to whichever OSD needed it first */
+    stats_begin(aosd);
+    ctx->xfixes_event = -1;
+    if (has_extension(ctx, EXT_XFIXES))
+    {
+      aosd->stats.round_trips++;
+      if (XFixesQueryExtension(ctx->display, &event_base, &error_base))
+      {
+        aosd->stats.round_trips++;
+        if (XFixesQueryVersion(ctx->display, &major, &minor) && major >= 2)
+          ctx->xfixes_event = event_base;
+      }
+    }
+    stats_end(aosd);
+  }
+
+  return ctx->xfixes_event > 0;
+}
+#endif
+
+AosdScreen*
+get_screen(Aosd* aosd)
+{
+  AosdScreen* scr = &aosd->context->screens[aosd->screen_num];
+
+  if (!scr->probed)
+  {
+#ifdef HAVE_XCOMPOSITE
+    Display* dsp = aosd->display;
+    Window root_win = RootWindow(dsp, aosd->screen_num);
+    int event_base, error_base;
+
+    stats_begin(aosd);
+    scr->composite = False;
+    if (has_extension(aosd->context, EXT_COMPOSITE))
+    {
+      aosd->stats.round_trips++;
+      scr->composite = XCompositeQueryExtension(dsp, &event_base, &error_base);
+    }
+    if (scr->composite)
+    {
+      /* one ARGB visual and colormap per screen, however many OSDs use it */
+      scr->argb_visual = composite_find_argb_visual(dsp, aosd->screen_num);
+      if (scr->argb_visual != NULL)
+        scr->argb_colormap = XCreateColormap(dsp, root_win,
+            scr->argb_visual, AllocNone);
+
+#ifdef HAVE_XFIXES
+      /* start listening before asking, so we can't miss a change */
+      if (probe_xfixes(aosd))
+      {
+        XFixesSelectSelectionInput(dsp, root_win, scr->cm_atom,
+            XFixesSetSelectionOwnerNotifyMask |
+            XFixesSelectionWindowDestroyNotifyMask |
+            XFixesSelectionClientCloseNotifyMask);
+        scr->cm_watched = True;
+      }
+#endif
+
+      scr->cm_running =
+        (XGetSelectionOwner(dsp, scr->cm_atom) != None);
+      aosd->stats.round_trips++;
+    }
+    stats_end(aosd);
+#endif
+    scr->probed = True;
+  }
+
+  return scr;
+}
+
+void
+free_screens(AosdContext* ctx)
+{
+  int i;
+
+  for (i = 0; i < ctx->n_screens; i++)
+  {
+    if (ctx->screens[i].argb_colormap != None)
+      XFreeColormap(ctx->display, ctx->screens[i].argb_colormap);
+    free(ctx->screens[i].monitors);
+  }
+
+  free(ctx->screens);
+  ctx->screens = NULL;
+}
+
+void
+register_id(Aosd* aosd, XID id)
+{
+  XSaveContext(aosd->display, id, aosd->context->ids, (XPointer)aosd);
+}
+
+void
+unregister_id(Aosd* aosd, XID id)
+{
+  XDeleteContext(aosd->display, id, aosd->context->ids);
+}
+
+/* the OSD an event is for, NULL if it isn't about one of our windows */
+Aosd*
+find_osd(AosdContext* ctx, XEvent* ev)
+{
+  XID id = ev->xany.window;
+  XPointer aosd;
+
+  if (ev->type == GenericEvent)
+  {
+    id = None;
+#ifdef HAVE_XPRESENT
+    if (ev->xcookie.extension == ctx->present_opcode &&
+        ev->xcookie.data != NULL)
+    {
+      if (ev->xcookie.evtype == PresentCompleteNotify)
+        id = ((XPresentCompleteNotifyEvent*)ev->xcookie.data)->window;
+      else if (ev->xcookie.evtype == PresentIdleNotify)
+        id = ((XPresentIdleNotifyEvent*)ev->xcookie.data)->window;
+    }
+#endif
+  }
+#ifdef HAVE_XSHM
+  /* completions name the buffer we uploaded into */
+  else if (ctx->shm_completion != 0 && ev->type == ctx->shm_completion)
+    id = ((XShmCompletionEvent*)ev)->drawable;
+#endif
+
+  if (id == None ||
+      XFindContext(ctx->display, id, ctx->ids, &aosd) != 0)
+    return NULL;
+
+  return (Aosd*)aosd;
+}
+
+/* root window events are selected per client, so the OSDs sharing
+ * a connection have to share the selection too */
+void
+watch_root(Aosd* aosd)
+{
+  if (get_screen(aosd)->root_watchers++ == 0)
+    XSelectInput(aosd->display, aosd->root_win, PropertyChangeMask);
+}
+
+void
+unwatch_root(Aosd* aosd)
+{
+  if (--get_screen(aosd)->root_watchers == 0)
+    XSelectInput(aosd->display, aosd->root_win, NoEventMask);
+}
+
+#if defined(HAVE_XCOMPOSITE) && defined(HAVE_XFIXES)
+static void
+composite_changed(Aosd* aosd)
+{
+  AosdScreen* scr = get_screen(aosd);
+  AosdTransparency mode = scr->cm_running ?
+    TRANSPARENCY_COMPOSITE : TRANSPARENCY_FAKE;
+
+  /* only ARGB windows can go either way */
+  if (aosd->requested_mode != TRANSPARENCY_COMPOSITE ||
+      aosd->win == None || aosd->visual != scr->argb_visual ||
+      aosd->mode == mode)
+    return;
+
+  aosd->mode = mode;
+
+  if (mode == TRANSPARENCY_COMPOSITE)
+  {
+    /* the compositor blends us from now on */
+    aosd->remap = 0;
+    free_background(aosd);
+#ifdef HAVE_XSYNC
+    make_frame_sync(aosd);
+#endif
+    if (aosd->shown)
+    {
+      aosd_render(aosd);
+      XMapRaised(aosd->display, aosd->win);
+    }
+  }
+  else
+  {
+#ifdef HAVE_XSYNC
+    aosd->pacing.frame_sync = False;
+    aosd->pacing.drawn_pending = False;
+#endif
+    /* the snapshot would show ourselves, so step aside until
+     * the windows below have repainted */
+    if (aosd->shown)
+    {
+      XUnmapWindow(aosd->display, aosd->win);
+      aosd->remap = get_time_us() + SNAPSHOT_SETTLE_MS * 1000ULL;
+    }
+  }
+}
+#endif
+
+Bool
+composite_handle_event(AosdContext* ctx, XEvent* ev)
+{
+#if defined(HAVE_XCOMPOSITE) && defined(HAVE_XFIXES)
+  XFixesSelectionNotifyEvent* sev = (XFixesSelectionNotifyEvent*)ev;
+  Aosd* aosd;
+  int i;
+
+  if (ctx->xfixes_event <= 0 ||
+      ev->type != ctx->xfixes_event + XFixesSelectionNotify)
+    return False;
+
+  for (i = 0; i < ctx->n_screens; i++)
+  {
+    AosdScreen* scr = &ctx->screens[i];
+
+    if (!scr->cm_watched || sev->selection != scr->cm_atom)
+      continue;
+
+    scr->cm_running = (sev->subtype == XFixesSetSelectionOwnerNotify &&
+        sev->owner != None);
+    /* a new compositor may well answer, and support other things */
+    scr->no_frame_drawn = False;
+    scr->opacity_probed = False;
+
+    for (aosd = ctx->osds; aosd != NULL; aosd = aosd->next)
+      if (aosd->screen_num == i)
+        composite_changed(aosd);
+  }
+
+  return True;
+#else
+  return False;
+#endif
+}
+
+/* the compositor let too many frames go unanswered: every OSD on the
+ * screen stops waiting for it, and new ones don't start */
+void
+frame_sync_unanswered(Aosd* aosd)
+{
+#ifdef HAVE_XSYNC
+  Aosd* osd;
+
+  get_screen(aosd)->no_frame_drawn = True;
+
+  for (osd = aosd->context->osds; osd != NULL; osd = osd->next)
+    if (osd->screen_num == aosd->screen_num)
+    {
+      osd->pacing.frame_sync = False;
+      osd->pacing.drawn_pending = False;
+    }
+#else
+  (void)aosd;
+#endif
+}
+
+/* whether anyone on the screen says it fades windows by their
+ * _NET_WM_WINDOW_OPACITY; compositors that do without saying so get
+ * the XRender fade instead, which works everywhere */
+Bool
+window_opacity_supported(Aosd* aosd)
+{
+  AosdScreen* scr = get_screen(aosd);
+  Atom* atoms = aosd->context->atoms;
+  Atom type;
+  int format;
+  unsigned long n, after, i;
+  unsigned char* data = NULL;
+
+  if (scr->opacity_probed)
+    return scr->opacity_supported;
+
+  scr->opacity_supported = False;
+
+  stats_begin(aosd);
+  if (XGetWindowProperty(aosd->display, aosd->root_win,
+        atoms[ATOM_NET_SUPPORTED], 0, 4096, False, XA_ATOM,
+        &type, &format, &n, &after, &data) == Success && data != NULL)
+  {
+    if (type == XA_ATOM && format == 32)
+      for (i = 0; i < n; i++)
+        if (((Atom*)data)[i] == atoms[ATOM_NET_WM_WINDOW_OPACITY])
+          scr->opacity_supported = True;
+    XFree(data);
+  }
+  aosd->stats.round_trips++;
+  stats_end(aosd);
+
+  scr->opacity_probed = True;
+  return scr->opacity_supported;
+}
+
+#ifdef HAVE_XRANDR
+/* XRRGetMonitors() is 1.5, older servers get the whole screen */
+static Bool
+probe_randr(Aosd* aosd)
+{
+  AosdContext* ctx = aosd->context;
+  int event_base, error_base, major = 0, minor = 0;
+
+  if (ctx->randr_event == 0)
+  {
+    ctx->randr_event = -1;
+    if (has_extension(ctx, EXT_RANDR))
+    {
+      aosd->stats.round_trips++;
+      if (XRRQueryExtension(ctx->display, &event_base, &error_base))
+      {
+        aosd->stats.round_trips++;
+        if (XRRQueryVersion(ctx->display, &major, &minor) &&
+            (major > 1 || (major == 1 && minor >= 5)))
+          ctx->randr_event = event_base;
+      }
+    }
+  }
+
+  return ctx->randr_event > 0;
+}
+#endif
+
+static AosdScreen*
+get_monitors(Aosd* aosd)
+{
+  AosdScreen* scr = get_screen(aosd);
+  Display* dsp = aosd->display;
+  int n = 0;
+
+  if (scr->monitors_valid)
+    return scr;
+
+  free(scr->monitors);
+  scr->monitors = NULL;
+  scr->primary = 0;
+
+  stats_begin(aosd);
+
+#ifdef HAVE_XRANDR
+  if (probe_randr(aosd))
+  {
+    Window root_win = RootWindow(dsp, aosd->screen_num);
+    XRRMonitorInfo* info;
+    int i;
+
+    /* start listening before asking, so we can't miss a change */
+    if (!scr->monitors_watched)
+    {
+      XRRSelectInput(dsp, root_win, RRScreenChangeNotifyMask);
+      scr->monitors_watched = True;
+    }
+
+    info = XRRGetMonitors(dsp, root_win, True, &n);
+    aosd->stats.round_trips++;
+    if (info != NULL && n > 0)
+    {
+      scr->monitors = malloc(n * sizeof(XRectangle));
+      for (i = 0; i < n; i++)
+      {
+        scr->monitors[i].x = info[i].x;
+        scr->monitors[i].y = info[i].y;
+        scr->monitors[i].width = info[i].width;
+        scr->monitors[i].height = info[i].height;
+        if (info[i].primary)
+          scr->primary = i;
+      }
+    }
+    else
+      n = 0;
+
+    if (info != NULL)
+      XRRFreeMonitors(info);
+  }
+#endif
+
+  if (n == 0)
+  {
+    n = 1;
+    scr->monitors = malloc(sizeof(XRectangle));
+    scr->monitors[0].x = 0;
+    scr->monitors[0].y = 0;
+    scr->monitors[0].width = DisplayWidth(dsp, aosd->screen_num);
+    scr->monitors[0].height = DisplayHeight(dsp, aosd->screen_num);
+  }
+
+  scr->n_monitors = n;
+  scr->monitors_valid = True;
+  stats_end(aosd);
+  return scr;
+}
+
+int
+monitor_count(Aosd* aosd)
+{
+  return get_monitors(aosd)->n_monitors;
+}
+
+void
+monitor_geometry(Aosd* aosd, int monitor, XRectangle* rect)
+{
+  Display* dsp = aosd->display;
+  AosdScreen* scr;
+  int i;
+
+  if (monitor == MONITOR_SCREEN)
+  {
+    rect->x = rect->y = 0;
+    rect->width = DisplayWidth(dsp, aosd->screen_num);
+    rect->height = DisplayHeight(dsp, aosd->screen_num);
+    return;
+  }
+
+  scr = get_monitors(aosd);
+
+  if (monitor == MONITOR_POINTER)
+  {
+    Window root_ret, child;
+    int x, y, win_x, win_y;
+    unsigned int mask;
+
+    /* the one round trip there's no avoiding */
+    monitor = MONITOR_PRIMARY;
+    aosd->stats.round_trips++;
+    if (XQueryPointer(dsp, RootWindow(dsp, aosd->screen_num),
+          &root_ret, &child, &x, &y, &win_x, &win_y, &mask))
+      for (i = 0; i < scr->n_monitors; i++)
+        if (x >= scr->monitors[i].x &&
+            x < scr->monitors[i].x + scr->monitors[i].width &&
+            y >= scr->monitors[i].y &&
+            y < scr->monitors[i].y + scr->monitors[i].height)
+        {
+          monitor = i;
+          break;
+        }
+  }
+
+  if (monitor < 0 || monitor >= scr->n_monitors)
+    monitor = scr->primary;
+
+  *rect = scr->monitors[monitor];
+}
+
+Bool
+monitors_handle_event(AosdContext* ctx, XEvent* ev)
+{
+#ifdef HAVE_XRANDR
+  XRRScreenChangeNotifyEvent* sev = (XRRScreenChangeNotifyEvent*)ev;
+  int i;
+
+  if (ctx->randr_event <= 0 ||
+      ev->type != ctx->randr_event + RRScreenChangeNotify)
+    return False;
+
+  /* keeps DisplayWidth() and DisplayHeight() in step as well */
+  XRRUpdateConfiguration(ev);
+
+  for (i = 0; i < ctx->n_screens; i++)
+    if (RootWindow(ctx->display, i) == sev->root)
+      ctx->screens[i].monitors_valid = False;
+
+  return True;
+#else
+  return False;
+#endif
+}
+
+void
+composite_tick(Aosd* aosd)
+{
+  if (aosd->remap == 0 || get_time_us() < aosd->remap)
+    return;
+
+  /* back in fake mode, with a fresh look at what's below us */
+  aosd->remap = 0;
+  if (aosd->shown && aosd->mode == TRANSPARENCY_FAKE)
+  {
+    update_snapshot(aosd);
+    aosd_render(aosd);
+    XMapRaised(aosd->display, aosd->win);
+  }
+}
+
+void
+make_window(Aosd* aosd)
+{
+  Display* dsp = aosd->display;
+  Window root_win = aosd->root_win;
+
+  if (aosd->win != None)
+  {
+    free_background(aosd);
+
+    /* the colormap belongs to the screen */
+    aosd->colormap = None;
+
+    free_pacing(aosd);
+    aosd->remap = 0;
+
+    unregister_id(aosd, aosd->win);
+    XDestroyWindow(dsp, aosd->win);
+    aosd->win = None;
+    aosd->resources.presented = False;
+  }
+
+  if (root_win == None)
+  {
+    free_content(aosd);
+    free_retained(aosd);
+    free_resources(aosd);
+    return;
+  }
+
+  XSetWindowAttributes att;
+
+  att.backing_store = WhenMapped;
+  att.background_pixel = 0x0;
+  att.border_pixel = 0;
+  att.background_pixmap = None;
+  att.colormap = None;
+  att.save_under = True;
+  att.event_mask = ExposureMask | StructureNotifyMask | ButtonPressMask;
+  att.override_redirect = True;
+
+  if (aosd->mode == TRANSPARENCY_COMPOSITE)
+  {
+#ifdef HAVE_XCOMPOSITE
+    AosdScreen* scr = get_screen(aosd);
+    Visual* visual = scr->argb_visual;
+
+    /* as long as we hear about compositors coming and going, an ARGB
+     * window does for fake transparency too, and never needs to be
+     * recreated when switching */
+    if (visual != NULL && (scr->cm_running || scr->cm_watched))
+    {
+      if (!scr->cm_running)
+        aosd->mode = TRANSPARENCY_FAKE;
+
+      aosd->visual = visual;
+      aosd->depth = 32;
+      aosd->colormap = att.colormap = scr->argb_colormap;
+      aosd->win = XCreateWindow(dsp, root_win,
+          -1, -1, 1, 1, 0, 32, InputOutput, visual,
+          CWBackingStore | CWBackPixel | CWBackPixmap | CWBorderPixel |
+          CWColormap | CWEventMask | CWSaveUnder | CWOverrideRedirect,
+          &att);
+    }
+    else
+#endif
+    {
+      aosd->mode = TRANSPARENCY_FAKE;
+      make_window(aosd);
+      return;
+    }
+  }
+  else
+  {
+    aosd->visual = DefaultVisual(dsp, aosd->screen_num);
+    aosd->depth = DefaultDepth(dsp, aosd->screen_num);
+    aosd->win = XCreateWindow(dsp, root_win,
+        -1, -1, 1, 1, 0, CopyFromParent, InputOutput, CopyFromParent,
+        CWBackingStore | CWBackPixel | CWBackPixmap | CWBorderPixel |
+        CWEventMask | CWSaveUnder | CWOverrideRedirect, &att);
+  }
+
+  register_id(aosd, aosd->win);
+  set_window_properties(aosd);
+  if (aosd->res_name != NULL && aosd->res_class != NULL)
+  {
+    XClassHint name = { aosd->res_name, aosd->res_class };
+    XSetClassHint(dsp, aosd->win, &name);
+  }
+  make_pacing(aosd);
+  if (aosd->width && aosd->height)
+    aosd_set_geometry(aosd, aosd->x, aosd->y, aosd->width, aosd->height);
+  if (aosd->shown)
+    aosd_show(aosd);
+}
+
+/* rects are relative to the snapshot */
+static void
+copy_snapshot(Aosd* aosd, const XRectangle* rects, int n)
+{
+  Display* dsp = aosd->display;
+  AosdBackground* bg = &aosd->background;
+  XRectangle whole;
+  XGCValues values;
+  GC gc;
+  int i;
+
+  if (rects == NULL)
+  {
+    whole.x = whole.y = 0;
+    whole.width = bg->width;
+    whole.height = bg->height;
+    rects = &whole;
+    n = 1;
+  }
+
+  if (aosd->depth != (unsigned int)DefaultDepth(dsp, aosd->screen_num))
+  {
+    /* an ARGB window waiting for a compositor; XRender converts the
+     * screen to its depth, with an opaque alpha channel */
+    XRenderPictureAttributes pa;
+    Picture src, dst;
+
+    pa.subwindow_mode = IncludeInferiors;
+    src = XRenderCreatePicture(dsp, aosd->root_win,
+        XRenderFindVisualFormat(dsp,
+          DefaultVisual(dsp, aosd->screen_num)),
+        CPSubwindowMode, &pa);
+    dst = XRenderCreatePicture(dsp, bg->pixmap,
+        XRenderFindVisualFormat(dsp, aosd->visual), 0, NULL);
+
+    for (i = 0; i < n; i++)
+      XRenderComposite(dsp, PictOpSrc, src, None, dst,
+          bg->x + rects[i].x, bg->y + rects[i].y, 0, 0,
+          rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+
+    XRenderFreePicture(dsp, src);
+    XRenderFreePicture(dsp, dst);
+  }
+  else
+  {
+    /* copy the screen, including whatever windows are on it */
+    values.subwindow_mode = IncludeInferiors;
+    values.graphics_exposures = False;
+    gc = XCreateGC(dsp, bg->pixmap,
+        GCSubwindowMode | GCGraphicsExposures, &values);
+
+    for (i = 0; i < n; i++)
+      XCopyArea(dsp, aosd->root_win, bg->pixmap, gc,
+          bg->x + rects[i].x, bg->y + rects[i].y,
+          rects[i].width, rects[i].height, rects[i].x, rects[i].y);
+
+    XFreeGC(dsp, gc);
+  }
+
+  /* keep the client-side copy in step */
+  if (bg->image != NULL)
+    for (i = 0; i < n; i++, aosd->stats.round_trips++)
+      XGetSubImage(dsp, bg->pixmap, rects[i].x, rects[i].y,
+          rects[i].width, rects[i].height, AllPlanes, ZPixmap,
+          bg->image, rects[i].x, rects[i].y);
+}
+
+#ifdef HAVE_XDAMAGE
+static void
+stop_tracking(Aosd* aosd)
+{
+  AosdBackground* bg = &aosd->background;
+
+  if (bg->damage == None)
+    return;
+
+  XDamageDestroy(aosd->display, bg->damage);
+  unwatch_root(aosd);
+  bg->damage = None;
+  bg->damaged = False;
+}
+
+static Bool
+start_tracking(Aosd* aosd)
+{
+  Display* dsp = aosd->display;
+  AosdBackground* bg = &aosd->background;
+  int event_base, error_base, major, minor;
+
+  if (bg->damage_event == 0)
+  {
+    /* the damaged regions are fetched through XFixes */
+    bg->damage_event = -1;
+    stats_begin(aosd);
+    if (probe_xfixes(aosd) && has_extension(aosd->context, EXT_DAMAGE))
+    {
+      aosd->stats.round_trips++;
+      if (XDamageQueryExtension(dsp, &event_base, &error_base))
+      {
+        aosd->stats.round_trips++;
+        if (XDamageQueryVersion(dsp, &major, &minor))
+          bg->damage_event = event_base + XDamageNotify;
+      }
+    }
+    stats_end(aosd);
+  }
+
+  if (bg->damage_event < 0)
+    return False;
+
+  /* a single event once anything gets drawn, the details are only
+   * fetched when we actually need the snapshot again */
+  bg->damage = XDamageCreate(dsp, aosd->root_win, XDamageReportNonEmpty);
+  bg->damaged = False;
+
+  /* and a new wallpaper makes the whole snapshot stale */
+  watch_root(aosd);
+
+  return True;
+}
+
+static void
+copy_damage(Aosd* aosd)
+{
+  Display* dsp = aosd->display;
+  AosdBackground* bg = &aosd->background;
+  XserverRegion region = XFixesCreateRegion(dsp, NULL, 0);
+  XRectangle* rects;
+  int i, n, m = 0;
+
+  XDamageSubtract(dsp, bg->damage, None, region);
+  rects = XFixesFetchRegion(dsp, region, &n);
+  aosd->stats.round_trips++;
+  XFixesDestroyRegion(dsp, region);
+
+  if (rects == NULL)
+    return;
+
+  /* keep what's under us, relative to the snapshot */
+  for (i = 0; i < n; i++)
+  {
+    int x1 = rects[i].x - bg->x, y1 = rects[i].y - bg->y;
+    int x2 = x1 + rects[i].width, y2 = y1 + rects[i].height;
+
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 > bg->width) x2 = bg->width;
+    if (y2 > bg->height) y2 = bg->height;
+
+    if (x1 < x2 && y1 < y2)
+    {
+      rects[m].x = x1;
+      rects[m].y = y1;
+      rects[m].width = x2 - x1;
+      rects[m].height = y2 - y1;
+      m++;
+    }
+  }
+
+  if (m > 0)
+    copy_snapshot(aosd, rects, m);
+
+  XFree(rects);
+}
+#endif
+
+#ifdef HAVE_XDAMAGE
+typedef struct
+{
+  Aosd* aosd;
+  Bool wallpaper;
+} SnapshotScan;
+
+/* takes the OSD's own damage off the queue, and only notes a new
+ * wallpaper */
+static Bool
+scan_snapshot_event(Display* dsp, XEvent* ev, XPointer arg)
+{
+  SnapshotScan* scan = (SnapshotScan*)arg;
+  Aosd* aosd = scan->aosd;
+  AosdBackground* bg = &aosd->background;
+
+  (void)dsp;
+
+  if (ev->type == bg->damage_event)
+    return ((XDamageNotifyEvent*)ev)->damage == bg->damage;
+
+  if (ev->type == PropertyNotify &&
+      ev->xproperty.window == aosd->root_win &&
+      ev->xproperty.atom == aosd->context->atoms[ATOM_XROOTPMAP_ID])
+    scan->wallpaper = True;
+
+  return False;
+}
+#endif
+
+void
+update_snapshot(Aosd* aosd)
+{
+  Display* dsp = aosd->display;
+  AosdBackground* bg = &aosd->background;
+  int width = aosd->width, height = aosd->height;
+  Bool reuse = bg->set && bg->valid &&
+    bg->x == aosd->x && bg->y == aosd->y &&
+    bg->width == width && bg->height == height;
+
+#ifdef HAVE_XDAMAGE
+  if (bg->damage != None)
+  {
+    XEvent ev;
+    SnapshotScan scan = { aosd, False };
+
+    /* pick up what the server already told us, without a round trip;
+     * other OSDs on the connection still need their damage and the
+     * wallpaper change, those stay queued */
+    XEventsQueued(dsp, QueuedAfterFlush);
+    while (XCheckIfEvent(dsp, &ev, scan_snapshot_event, (XPointer)&scan))
+      bg->damaged = True;
+
+    if (scan.wallpaper)
+    {
+      bg->valid = False;
+      stop_tracking(aosd);
+    }
+
+    reuse = reuse && bg->valid;
+  }
+  else
+#endif
+  /* nothing tells us whether an unwatched snapshot still holds */
+  reuse = False;
+
+  if (!reuse)
+  {
+    if (!bg->set || bg->width != width || bg->height != height)
+    {
+      free_background(aosd);
+      bg->pixmap = XCreatePixmap(dsp, aosd->win,
+          width, height, aosd->depth);
+      bg->set = True;
+    }
+
+    bg->x = aosd->x;
+    bg->y = aosd->y;
+    bg->width = width;
+    bg->height = height;
+    copy_snapshot(aosd, NULL, 0);
+  }
+#ifdef HAVE_XDAMAGE
+  else if (bg->damaged)
+    copy_damage(aosd);
+
+  /* nothing under us changes while we're shown */
+  stop_tracking(aosd);
+#endif
+
+  bg->valid = True;
+}
+
+/* a shown OSD moves or changes size: what's below its old place is
+ * only in the old snapshot, the rest can still come from the screen,
+ * as long as the window isn't over there yet */
+void
+move_snapshot(Aosd* aosd, int x, int y, int width, int height)
+{
+  Display* dsp = aosd->display;
+  AosdBackground* bg = &aosd->background;
+  Pixmap old;
+  XGCValues values;
+  XRectangle rects[4];
+  GC gc;
+  int x1, y1, x2, y2, m = 0;
+
+  if (!bg->set || !bg->valid || width <= 0 || height <= 0 ||
+      (bg->x == x && bg->y == y &&
+       bg->width == width && bg->height == height))
+    return;
+
+  /* the client-side copy gets fetched again whole */
+  if (bg->image != NULL)
+  {
+    XDestroyImage(bg->image);
+    bg->image = NULL;
+  }
+
+  old = bg->pixmap;
+  bg->pixmap = XCreatePixmap(dsp, aosd->win, width, height, aosd->depth);
+
+  /* the overlap, in screen coordinates */
+  x1 = bg->x > x ? bg->x : x;
+  y1 = bg->y > y ? bg->y : y;
+  x2 = bg->x + bg->width < x + width ? bg->x + bg->width : x + width;
+  y2 = bg->y + bg->height < y + height ? bg->y + bg->height : y + height;
+
+  if (x1 < x2 && y1 < y2)
+  {
+    values.graphics_exposures = False;
+    gc = XCreateGC(dsp, old, GCGraphicsExposures, &values);
+    XCopyArea(dsp, old, bg->pixmap, gc,
+        x1 - bg->x, y1 - bg->y, x2 - x1, y2 - y1, x1 - x, y1 - y);
+    XFreeGC(dsp, gc);
+
+    /* around it, relative to the new snapshot */
+    if (y1 > y)
+      rects[m++] = (XRectangle){ 0, 0, width, y1 - y };
+    if (y2 < y + height)
+      rects[m++] = (XRectangle){ 0, y2 - y, width, y + height - y2 };
+    if (x1 > x)
+      rects[m++] = (XRectangle){ 0, y1 - y, x1 - x, y2 - y1 };
+    if (x2 < x + width)
+      rects[m++] = (XRectangle){ x2 - x, y1 - y, x + width - x2, y2 - y1 };
+  }
+  else
+  {
+    rects[0] = (XRectangle){ 0, 0, width, height };
+    m = 1;
+  }
+
+  XFreePixmap(dsp, old);
+  bg->x = x;
+  bg->y = y;
+  bg->width = width;
+  bg->height = height;
+
+  copy_snapshot(aosd, rects, m);
+}
+
+void
+snapshot_hidden(Aosd* aosd)
+{
+  AosdBackground* bg = &aosd->background;
+
+  if (aosd->mode != TRANSPARENCY_FAKE || !bg->valid)
+    return;
+
+#ifdef HAVE_XDAMAGE
+  /* watch from the moment we're gone; the repaint of what was below
+   * us shows up as damage too, but that's copied before we map again
+   * and the screen can't change in between without us hearing of it */
+  if (start_tracking(aosd))
+    return;
+#endif
+  bg->valid = False;
+}
+
+Bool
+snapshot_handle_event(Aosd* aosd, XEvent* ev)
+{
+#ifdef HAVE_XDAMAGE
+  AosdBackground* bg = &aosd->background;
+
+  if (bg->damage == None)
+    return False;
+
+  if (ev->type == bg->damage_event)
+  {
+    /* everyone on the connection sees everyone's damage */
+    if (((XDamageNotifyEvent*)ev)->damage != bg->damage)
+      return False;
+
+    bg->damaged = True;
+    return True;
+  }
+
+  if (ev->type == PropertyNotify && ev->xproperty.window == aosd->root_win)
+  {
+    /* new wallpaper, start over */
+    if (ev->xproperty.atom == aosd->context->atoms[ATOM_XROOTPMAP_ID])
+    {
+      bg->valid = False;
+      stop_tracking(aosd);
+    }
+    return True;
+  }
+#endif
+
+  return False;
+}
+
+void
+free_background(Aosd* aosd)
+{
+  AosdBackground* bg = &aosd->background;
+
+#ifdef HAVE_XDAMAGE
+  stop_tracking(aosd);
+#endif
+
+  if (bg->image != NULL)
+  {
+    XDestroyImage(bg->image);
+    bg->image = NULL;
+  }
+
+  if (bg->set)
+  {
+    XFreePixmap(aosd->display, bg->pixmap);
+    bg->set = False;
+  }
+
+  bg->valid = False;
+}
+
+#ifdef HAVE_XSHM
+static Bool shm_attach_failed;
+
+static int
+shm_error_handler(Display* dsp, XErrorEvent* ev)
+{
+  shm_attach_failed = True;
+  return 0;
+}
+
+static XImage*
+shm_create_image(Aosd* aosd)
+{
+  AosdResources* res = &aosd->resources;
+  Display* dsp = aosd->display;
+  XErrorHandler handler;
+  XImage* image;
+
+  if (!has_extension(aosd->context, EXT_SHM))
+    return NULL;
+
+  aosd->stats.round_trips++;
+  if (!XShmQueryExtension(dsp))
+    return NULL;
+
+  image = XShmCreateImage(dsp, aosd->visual, aosd->depth, ZPixmap, NULL,
+      &res->shminfo, aosd->width, aosd->height);
+  if (image == NULL)
+    return NULL;
+
+  res->shminfo.shmid = shmget(IPC_PRIVATE,
+      image->bytes_per_line * image->height, IPC_CREAT | 0600);
+  if (res->shminfo.shmid == -1)
+  {
+    XDestroyImage(image);
+    return NULL;
+  }
+
+  res->shminfo.shmaddr = image->data = shmat(res->shminfo.shmid, NULL, 0);
+  res->shminfo.readOnly = True;
+
+  /* the segment goes away as soon as both sides detach from it */
+  shmctl(res->shminfo.shmid, IPC_RMID, NULL);
+
+  if (image->data == (char*)-1)
+  {
+    image->data = NULL;
+    XDestroyImage(image);
+    return NULL;
+  }
+
+  /* attaching fails on remote displays, and we only learn about it
+   * through the error handler */
+  shm_attach_failed = False;
+  handler = XSetErrorHandler(shm_error_handler);
+  XShmAttach(dsp, &res->shminfo);
+  XSync(dsp, False);
+  aosd->stats.round_trips++;
+  XSetErrorHandler(handler);
+
+  if (shm_attach_failed)
+  {
+    shmdt(res->shminfo.shmaddr);
+    image->data = NULL;
+    XDestroyImage(image);
+    return NULL;
+  }
+
+  res->shm = True;
+  res->shm_completion = aosd->context->shm_completion =
+    XShmGetEventBase(dsp) + ShmCompletion;
+  return image;
+}
+#endif
+
+static void
+free_client_image(Aosd* aosd)
+{
+  AosdResources* res = &aosd->resources;
+
+  if (res->image == NULL)
+    return;
+
+  if (res->image_surface != NULL)
+    cairo_surface_destroy(res->image_surface);
+
+#ifdef HAVE_XSHM
+  if (res->shm)
+  {
+    XShmDetach(aosd->display, &res->shminfo);
+    shmdt(res->shminfo.shmaddr);
+    res->image->data = NULL;
+  }
+#endif
+
+  /* frees the pixel data too unless it's the shared segment */
+  XDestroyImage(res->image);
+}
+
+static Bool
+make_client_image(Aosd* aosd)
+{
+  AosdResources* res = &aosd->resources;
+  Visual* visual = aosd->visual;
+  union { int i; char c; } host = { 1 };
+  int byte_order = host.c ? LSBFirst : MSBFirst;
+  cairo_format_t format;
+  XImage* image = NULL;
+
+  /* cairo can only draw straight into 8 bits per channel xRGB/ARGB */
+  if (visual->red_mask != 0xff0000 ||
+      visual->green_mask != 0xff00 ||
+      visual->blue_mask != 0xff)
+    return False;
+
+  if (aosd->depth == 32)
+    format = CAIRO_FORMAT_ARGB32;
+  else if (aosd->depth == 24)
+    format = CAIRO_FORMAT_RGB24;
+  else
+    return False;
+
+#ifdef HAVE_XSHM
+  image = shm_create_image(aosd);
+#endif
+
+  /* no MIT-SHM, upload with plain XPutImage() */
+  if (image == NULL)
+  {
+    image = XCreateImage(aosd->display, visual, aosd->depth, ZPixmap, 0,
+        NULL, aosd->width, aosd->height, 32, 0);
+    if (image == NULL)
+      return False;
+    image->data = malloc(image->bytes_per_line * image->height);
+  }
+
+  res->image = image;
+
+  if (image->data == NULL ||
+      image->bits_per_pixel != 32 ||
+      image->byte_order != byte_order)
+  {
+    free_client_image(aosd);
+    res->image = NULL;
+#ifdef HAVE_XSHM
+    res->shm = False;
+#endif
+    return False;
+  }
+
+  res->image_surface = cairo_image_surface_create_for_data(
+      (unsigned char*)image->data, format,
+      aosd->width, aosd->height, image->bytes_per_line);
+
+  return True;
+}
+
+cairo_surface_t*
+create_surface(Aosd* aosd, Drawable drawable, XRenderPictFormat* format,
+    int width, int height)
+{
+#ifdef HAVE_XCB
+  xcb_screen_iterator_t it =
+    xcb_setup_roots_iterator(xcb_get_setup(aosd->context->xcb));
+  xcb_render_pictforminfo_t info;
+  int i;
+
+  for (i = 0; i < aosd->screen_num; i++)
+    xcb_screen_next(&it);
+
+  /* describe the format we already have, rather than having
+   * cairo look it up on the server again */
+  memset(&info, 0, sizeof(info));
+  info.id = format->id;
+  info.type = format->type;
+  info.depth = format->depth;
+  info.direct.red_shift = format->direct.red;
+  info.direct.red_mask = format->direct.redMask;
+  info.direct.green_shift = format->direct.green;
+  info.direct.green_mask = format->direct.greenMask;
+  info.direct.blue_shift = format->direct.blue;
+  info.direct.blue_mask = format->direct.blueMask;
+  info.direct.alpha_shift = format->direct.alpha;
+  info.direct.alpha_mask = format->direct.alphaMask;
+  info.colormap = format->colormap;
+
+  return cairo_xcb_surface_create_with_xrender_format(aosd->context->xcb,
+      it.data, drawable, &info, width, height);
+#else
+  return cairo_xlib_surface_create_with_xrender_format(aosd->display,
+      drawable, ScreenOfDisplay(aosd->display, aosd->screen_num), format,
+      width, height);
+#endif
+}
+
+Bool
+make_resources(Aosd* aosd)
+{
+  AosdResources* res = &aosd->resources;
+  Display* dsp = aosd->display;
+  int width = aosd->width, height = aosd->height;
+  unsigned long long start;
+  int i;
+
+  if (res->set &&
+      res->width == width && res->height == height &&
+      res->depth == aosd->depth && res->visual == aosd->visual &&
+      res->render_mode == aosd->render_mode)
+    return True;
+
+  free_resources(aosd);
+
+  if (width <= 0 || height <= 0 || aosd->visual == NULL)
+    return False;
+
+  start = get_time_us();
+
+  res->xrformat = XRenderFindVisualFormat(dsp, aosd->visual);
+
+  /* copies between our own pixmaps never need exposures */
+  XGCValues values;
+  values.graphics_exposures = False;
+
+  for (i = 0; i < 2; i++)
+  {
+    AosdBuffer* buf = &res->buffer[i];
+
+    buf->pixmap = XCreatePixmap(dsp, aosd->root_win,
+        width, height, aosd->depth);
+    register_id(aosd, buf->pixmap);
+    buf->gc = XCreateGC(dsp, buf->pixmap, GCGraphicsExposures, &values);
+    buf->picture = XRenderCreatePicture(dsp, buf->pixmap,
+        res->xrformat, 0, NULL);
+    buf->surface = create_surface(aosd, buf->pixmap, res->xrformat,
+        width, height);
+  }
+
+  /* formats cairo can't rasterize into stay on the server path */
+  if (aosd->render_mode == RENDER_CLIENT)
+    make_client_image(aosd);
+
+  res->front = 0;
+  res->render_mode = aosd->render_mode;
+  res->width = width;
+  res->height = height;
+  res->depth = aosd->depth;
+  res->visual = aosd->visual;
+  res->set = True;
+
+  stats_record(&aosd->stats.setup_time, get_time_us() - start);
+  return True;
+}
+
+void
+free_resources(Aosd* aosd)
+{
+  AosdResources* res = &aosd->resources;
+  int i;
+
+  if (!res->set)
+    return;
+
+  free_client_image(aosd);
+
+  for (i = 0; i < 2; i++)
+  {
+    AosdBuffer* buf = &res->buffer[i];
+
+    cairo_surface_destroy(buf->surface);
+    XRenderFreePicture(aosd->display, buf->picture);
+    XFreeGC(aosd->display, buf->gc);
+    unregister_id(aosd, buf->pixmap);
+    /* the server keeps the storage alive while the window
+     * still uses it as its background */
+    XFreePixmap(aosd->display, buf->pixmap);
+  }
+
+  memset(res, 0, sizeof(AosdResources));
+}
+
+void
+swap_buffers(Aosd* aosd)
+{
+  aosd->resources.front = !aosd->resources.front;
+}
+
+Bool
+make_content(Aosd* aosd)
+{
+  AosdContent* content = &aosd->content;
+  Display* dsp = aosd->display;
+  int width = aosd->width, height = aosd->height;
+  XRenderPictFormat* xrformat;
+  cairo_surface_t* surf;
+  unsigned long long start;
+  GC gc;
+
+  free_content(aosd);
+
+  if (width <= 0 || height <= 0)
+    return False;
+
+  start = get_time_us();
+
+  /* always ARGB, whatever the window is, so it can be blended */
+  xrformat = XRenderFindStandardFormat(dsp, PictStandardARGB32);
+  content->pixmap = XCreatePixmap(dsp, aosd->root_win, width, height, 32);
+  content->picture = XRenderCreatePicture(dsp, content->pixmap,
+      xrformat, 0, NULL);
+
+  /* start out fully transparent */
+  gc = XCreateGC(dsp, content->pixmap, 0, NULL);
+  XFillRectangle(dsp, content->pixmap, gc, 0, 0, width, height);
+  XFreeGC(dsp, gc);
+
+  if (aosd->renderer.render_cb)
+  {
+    surf = create_surface(aosd, content->pixmap, xrformat, width, height);
+    stats_record(&aosd->stats.setup_time, get_time_us() - start);
+
+    cairo_t* cr = cairo_create(surf);
+    call_renderer(aosd, cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(surf);
+  }
+  else
+    stats_record(&aosd->stats.setup_time, get_time_us() - start);
 
-#include "aosd-internal.h"
+  content->width = width;
+  content->height = height;
+  content->set = True;
+
+  return True;
+}
 
 void
-make_window(Aosd* aosd)
+free_content(Aosd* aosd)
+{
+  AosdContent* content = &aosd->content;
+
+  if (!content->set)
+    return;
+
+  XRenderFreePicture(aosd->display, content->picture);
+  XFreePixmap(aosd->display, content->pixmap);
+  memset(content, 0, sizeof(AosdContent));
+}
+
+void
+present_content(Aosd* aosd, float alpha)
 {
   Display* dsp = aosd->display;
-  Window root_win = aosd->root_win;
+  AosdContent* content = &aosd->content;
+  AosdBuffer* buf;
 
-  if (aosd->win != None)
+  if (!make_resources(aosd))
+    return;
+
+  buf = &aosd->resources.buffer[!aosd->resources.front];
+  wait_for_buffer(aosd, buf);
+  server_background(aosd, buf, NULL, 0);
+
+  /* the per-frame cost is one blend, however complex the content is */
+  if (content->set && alpha > 0.0)
+  {
+    XRenderColor color = { 0, 0, 0, alpha >= 1.0 ? 0xffff : alpha * 0xffff };
+    Picture mask = XRenderCreateSolidFill(dsp, &color);
+
+    XRenderComposite(dsp, PictOpOver, content->picture, mask, buf->picture,
+        0, 0, 0, 0, 0, 0, content->width, content->height);
+    XRenderFreePicture(dsp, mask);
+  }
+
+  present_buffer(aosd, buf);
+  swap_buffers(aosd);
+  aosd->resources.presented = True;
+  aosd->stats.renders++;
+}
+
+void
+set_window_opacity(Aosd* aosd, float alpha)
+{
+  Display* dsp = aosd->display;
+  Atom opacity = aosd->context->atoms[ATOM_NET_WM_WINDOW_OPACITY];
+  unsigned long value;
+
+  if (alpha <= 0.0)
+    value = 0;
+  else if (alpha >= 1.0)
+    value = 0xffffffff;
+  else
+    value = alpha * 0xffffffff;
+
+  XChangeProperty(dsp, aosd->win, opacity, XA_CARDINAL, 32,
+      PropModeReplace, (unsigned char*)&value, 1);
+}
+
+void
+unset_window_opacity(Aosd* aosd)
+{
+  Display* dsp = aosd->display;
+  Atom opacity = aosd->context->atoms[ATOM_NET_WM_WINDOW_OPACITY];
+
+  XDeleteProperty(dsp, aosd->win, opacity);
+}
+
+void
+present_buffer(Aosd* aosd, AosdBuffer* buf)
+{
+  Display* dsp = aosd->display;
+  Window win = aosd->win;
+  AosdPacing* pacing = &aosd->pacing;
+
+#ifdef HAVE_XSYNC
+  /* odd value: the compositor must not paint a half-updated window */
+  if (pacing->frame_sync)
+    set_frame_counter(aosd, ++pacing->counter_value);
+#endif
+
+  /* point window at its new backing pixmap, exposures get repainted
+   * from it whichever way the frame reaches the screen */
+  XSetWindowBackgroundPixmap(dsp, win, buf->pixmap);
+
+#ifdef HAVE_XPRESENT
+  if (pacing->present)
+  {
+    /* have it shown at the next vertical blank */
+    XPresentPixmap(dsp, win, buf->pixmap, ++pacing->serial,
+        None, None, 0, 0, None, None, None, PresentOptionNone,
+        0, 0, 0, NULL, 0);
+    buf->busy = True;
+    pacing->present_pending = True;
+  }
+  else
+#endif
+    /* and tell the window to redraw with this pixmap */
+    XClearWindow(dsp, win);
+
+#ifdef HAVE_XSYNC
+  if (pacing->frame_sync)
+  {
+    set_frame_counter(aosd, ++pacing->counter_value);
+    /* nobody draws frames of an unmapped window */
+    pacing->drawn_pending = aosd->shown;
+  }
+#endif
+
+  pacing->since = get_time_us();
+}
+
+Bool
+pacing_handle_event(Aosd* aosd, XEvent* ev)
+{
+#if defined(HAVE_XSYNC) || defined(HAVE_XPRESENT)
+  AosdPacing* pacing = &aosd->pacing;
+#endif
+
+#ifdef HAVE_XSYNC
+  if (ev->type == ClientMessage && pacing->frame_sync &&
+      ev->xclient.window == aosd->win &&
+      ev->xclient.message_type ==
+      aosd->context->atoms[ATOM_NET_WM_FRAME_DRAWN])
   {
-    if (aosd->background.set)
+    unsigned long long value =
+      ((unsigned long long)ev->xclient.data.l[0] & 0xffffffff) |
+      ((unsigned long long)ev->xclient.data.l[1] << 32);
+
+    if (value >= pacing->counter_value)
     {
-      XFreePixmap(dsp, aosd->background.pixmap);
-      aosd->background.set = False;
+      pacing->drawn_pending = False;
+      pacing->missed = 0;
     }
+    return True;
+  }
+#endif
+
+#ifdef HAVE_XPRESENT
+  /* the dispatcher fetched the cookie data already */
+  if (ev->type == GenericEvent && pacing->present &&
+      ev->xcookie.extension == pacing->present_opcode)
+  {
+    if (ev->xcookie.data == NULL)
+      return True;
 
-    if (aosd->colormap != None)
+    if (ev->xcookie.evtype == PresentCompleteNotify)
     {
-      XFreeColormap(dsp, aosd->colormap);
-      aosd->colormap = None;
+      XPresentCompleteNotifyEvent* ce = ev->xcookie.data;
+
+      if (ce->window == aosd->win && ce->serial_number == pacing->serial)
+      {
+        pacing->present_pending = False;
+        pacing->ust = ce->ust;
+        pacing->msc = ce->msc;
+      }
     }
+    else if (ev->xcookie.evtype == PresentIdleNotify)
+    {
+      XPresentIdleNotifyEvent* ie = ev->xcookie.data;
+      int i;
 
-    XDestroyWindow(dsp, aosd->win);
-    aosd->win = None;
+      for (i = 0; i < 2; i++)
+        if (ie->window == aosd->win &&
+            aosd->resources.buffer[i].pixmap == ie->pixmap)
+          aosd->resources.buffer[i].busy = False;
+    }
+    return True;
   }
+#endif
 
-  if (root_win == None)
-    return;
+  return False;
+}
 
-  XSetWindowAttributes att;
+void
+server_background(Aosd* aosd, AosdBuffer* buf,
+    const XRectangle* rects, int n)
+{
+  Display* dsp = aosd->display;
+  int i;
 
-  att.backing_store = WhenMapped;
-  att.background_pixel = 0x0;
-  att.border_pixel = 0;
-  att.background_pixmap = None;
-  att.colormap = None;
-  att.save_under = True;
-  att.event_mask = ExposureMask | StructureNotifyMask | ButtonPressMask;
-  att.override_redirect = True;
+  if (rects == NULL)
+  {
+    if (aosd->mode == TRANSPARENCY_FAKE && aosd->background.set)
+      /* make our own copy of the background pixmap as the initial surface */
+      XCopyArea(dsp, aosd->background.pixmap, buf->pixmap, buf->gc,
+          0, 0, aosd->width, aosd->height, 0, 0);
+    else
+      XFillRectangle(dsp, buf->pixmap, buf->gc,
+          0, 0, aosd->width, aosd->height);
+  }
+  else
+  {
+    if (aosd->mode == TRANSPARENCY_FAKE && aosd->background.set)
+      for (i = 0; i < n; i++)
+        XCopyArea(dsp, aosd->background.pixmap, buf->pixmap, buf->gc,
+            rects[i].x, rects[i].y, rects[i].width, rects[i].height,
+            rects[i].x, rects[i].y);
+    else
+      XFillRectangles(dsp, buf->pixmap, buf->gc, (XRectangle*)rects, n);
+  }
+}
 
-  if (aosd->mode == TRANSPARENCY_COMPOSITE)
+void
+client_background(Aosd* aosd, const XRectangle* rects, int n)
+{
+  AosdResources* res = &aosd->resources;
+  AosdBackground* bg = &aosd->background;
+  XImage* image = res->image;
+  XRectangle whole = { 0, 0, res->width, res->height };
+  int i, y;
+
+  if (rects == NULL)
   {
-#ifdef HAVE_XCOMPOSITE
-    Visual* visual = NULL;
-    if (composite_check_ext_and_mgr(dsp, aosd->screen_num) &&
-        (visual = composite_find_argb_visual(dsp, aosd->screen_num)) != NULL)
+    rects = &whole;
+    n = 1;
+  }
+
+  /* fetch the snapshot once; every frame afterwards is a plain memcpy */
+  if (aosd->mode == TRANSPARENCY_FAKE && bg->set && bg->image == NULL)
+  {
+    bg->image = XGetImage(aosd->display, bg->pixmap,
+        0, 0, res->width, res->height, AllPlanes, ZPixmap);
+    aosd->stats.round_trips++;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    int x1 = rects[i].x, y1 = rects[i].y;
+    int x2 = x1 + rects[i].width, y2 = y1 + rects[i].height;
+
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 > image->width) x2 = image->width;
+    if (y2 > image->height) y2 = image->height;
+
+    if (aosd->mode == TRANSPARENCY_FAKE && bg->image != NULL &&
+        bg->image->bits_per_pixel == 32)
     {
-      aosd->visual = visual;
-      aosd->colormap = att.colormap =
-        XCreateColormap(dsp, root_win, visual, AllocNone);
-      aosd->win = XCreateWindow(dsp, root_win,
-          -1, -1, 1, 1, 0, 32, InputOutput, visual,
-          CWBackingStore | CWBackPixel | CWBackPixmap | CWBorderPixel |
-          CWColormap | CWEventMask | CWSaveUnder | CWOverrideRedirect,
-          &att);
+      if (x2 > bg->image->width) x2 = bg->image->width;
+      if (y2 > bg->image->height) y2 = bg->image->height;
+
+      for (y = y1; y < y2 && x1 < x2; y++)
+        memcpy(image->data + y * image->bytes_per_line + x1 * 4,
+            bg->image->data + y * bg->image->bytes_per_line + x1 * 4,
+            (x2 - x1) * 4);
+    }
+    else
+      for (y = y1; y < y2 && x1 < x2; y++)
+        memset(image->data + y * image->bytes_per_line + x1 * 4,
+            0, (x2 - x1) * 4);
+  }
+}
+
+/* rect cut down to the image, False if nothing is left of it */
+static Bool
+clip_to_image(const AosdResources* res, const XRectangle* rect,
+    XRectangle* clipped)
+{
+  int x1 = rect->x, y1 = rect->y;
+  int x2 = x1 + rect->width, y2 = y1 + rect->height;
+
+  if (x1 < 0) x1 = 0;
+  if (y1 < 0) y1 = 0;
+  if (x2 > res->width) x2 = res->width;
+  if (y2 > res->height) y2 = res->height;
+
+  if (x1 >= x2 || y1 >= y2)
+    return False;
+
+  clipped->x = x1;
+  clipped->y = y1;
+  clipped->width = x2 - x1;
+  clipped->height = y2 - y1;
+  return True;
+}
+
+void
+upload_image(Aosd* aosd, AosdBuffer* buf, const XRectangle* rects, int n)
+{
+  AosdResources* res = &aosd->resources;
+  XRectangle whole = { 0, 0, res->width, res->height };
+  XRectangle rect;
+  int i, last = -1;
+
+  if (rects == NULL)
+  {
+    rects = &whole;
+    n = 1;
+  }
+
+  /* the server refuses, or we read past the image, for anything
+   * reaching outside it */
+  for (i = 0; i < n; i++)
+    if (clip_to_image(res, &rects[i], &rect))
+      last = i;
+
+  for (i = 0; i <= last; i++)
+  {
+    if (!clip_to_image(res, &rects[i], &rect))
+      continue;
+
+    aosd->stats.bytes_uploaded += (unsigned long long)rect.width *
+      rect.height * (res->image->bits_per_pixel / 8);
+
+#ifdef HAVE_XSHM
+    if (res->shm)
+    {
+      /* ask for a completion event on the last one only, we must not
+       * scribble over the segment before the server is done reading */
+      XShmPutImage(aosd->display, buf->pixmap, buf->gc, res->image,
+          rect.x, rect.y, rect.x, rect.y,
+          rect.width, rect.height, i == last);
+      res->upload_pending = True;
     }
     else
 #endif
+      XPutImage(aosd->display, buf->pixmap, buf->gc, res->image,
+          rect.x, rect.y, rect.x, rect.y, rect.width, rect.height);
+  }
+}
+
+#ifdef HAVE_XSHM
+static Bool
+is_shm_completion(Display* dsp, XEvent* ev, XPointer arg)
+{
+  Aosd* aosd = (Aosd*)arg;
+  Drawable drawable = ((XShmCompletionEvent*)ev)->drawable;
+
+  return ev->type == aosd->resources.shm_completion &&
+    (drawable == aosd->resources.buffer[0].pixmap ||
+     drawable == aosd->resources.buffer[1].pixmap);
+}
+#endif
+
+void
+wait_for_upload(Aosd* aosd)
+{
+#ifdef HAVE_XSHM
+  AosdResources* res = &aosd->resources;
+  XEvent ev;
+
+  if (!res->upload_pending)
+    return;
+
+  XIfEvent(aosd->display, &ev, is_shm_completion, (XPointer)aosd);
+  res->upload_pending = False;
+#endif
+}
+
+Bool
+make_offscreen(Aosd* aosd)
+{
+  AosdOffscreen* off = &aosd->offscreen;
+  int width = aosd->width;
+  int height = aosd->height;
+  unsigned long long start;
+
+  /* the caller's buffer bounds the frame, we never write past it */
+  if (off->data != NULL)
+  {
+    if (width > off->width)
+      width = off->width;
+    if (height > off->height)
+      height = off->height;
+  }
+
+  if (off->surface != NULL &&
+      cairo_image_surface_get_width(off->surface) == width &&
+      cairo_image_surface_get_height(off->surface) == height)
+    return True;
+
+  free_offscreen(aosd);
+
+  if (width <= 0 || height <= 0)
+    return False;
+
+  start = get_time_us();
+  if (off->data != NULL)
+    off->surface = cairo_image_surface_create_for_data(off->data,
+        CAIRO_FORMAT_ARGB32, width, height, off->stride);
+  else
+    off->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+        width, height);
+
+  if (cairo_surface_status(off->surface) != CAIRO_STATUS_SUCCESS)
+  {
+    free_offscreen(aosd);
+    return False;
+  }
+
+  stats_record(&aosd->stats.setup_time, get_time_us() - start);
+
+  return True;
+}
+
+void
+free_offscreen(Aosd* aosd)
+{
+  AosdOffscreen* off = &aosd->offscreen;
+
+  if (off->surface == NULL)
+    return;
+
+  cairo_surface_destroy(off->surface);
+  off->surface = NULL;
+}
+
+void
+stats_record(AosdHistogram* hist, unsigned long long us)
+{
+  int i = 0;
+
+  hist->count++;
+  hist->total_us += us;
+  if (us > hist->max_us)
+    hist->max_us = us;
+
+  while (i < AOSD_HISTOGRAM_BUCKETS - 1 && us >= (1ULL << i))
+    i++;
+  hist->buckets[i]++;
+}
+
+/* the X requests issued until the matching stats_end() are charged to
+ * the OSD; they nest, only the outermost pair counts.  on XCB, what
+ * cairo sends shows up with the next request of our own */
+void
+stats_begin(Aosd* aosd)
+{
+  if (!aosd->headless && aosd->stats_depth++ == 0)
+    aosd->stats_serial = NextRequest(aosd->display);
+}
+
+void
+stats_end(Aosd* aosd)
+{
+  if (!aosd->headless && --aosd->stats_depth == 0)
+    aosd->stats.requests += NextRequest(aosd->display) - aosd->stats_serial;
+}
+
+static void
+run_renderer(Aosd* aosd, RenderCallback* renderer, cairo_t* cr)
+{
+  unsigned long long start;
+
+  start = get_time_us();
+  renderer->render_cb(cr, renderer->data);
+  stats_record(&aosd->stats.render_time, get_time_us() - start);
+}
+
+void
+call_renderer(Aosd* aosd, cairo_t* cr)
+{
+  if (aosd->renderer.render_cb == NULL)
+    return;
+
+  /* a FADE_RENDER flash's renderer fades the retained copy itself */
+  if (aosd->retained.enabled &&
+      !(aosd->flash.active && aosd->flash.fade == FADE_RENDER))
+    paint_retained(aosd, cr, &aosd->renderer, 1.0);
+  else
+    run_renderer(aosd, &aosd->renderer, cr);
+}
+
+/* draws the renderer's output onto cr from the retained copy, which
+ * gets rendered first if it isn't good any more */
+void
+paint_retained(Aosd* aosd, cairo_t* cr, RenderCallback* renderer, double alpha)
+{
+  AosdRetained* retained = &aosd->retained;
+  cairo_t* rcr;
+
+  if (renderer->render_cb == NULL)
+    return;
+
+  if (retained->renderer.render_cb != renderer->render_cb ||
+      retained->renderer.data != renderer->data ||
+      retained->width != aosd->width || retained->height != aosd->height)
+    free_retained(aosd);
+
+  /* a server-side copy painted into a client-side frame, or the other
+   * way round, would cross the wire every time */
+  if (retained->surface != NULL &&
+      cairo_surface_get_type(retained->surface) !=
+      cairo_surface_get_type(cairo_get_target(cr)))
+    free_retained(aosd);
+
+  if (retained->surface == NULL)
+  {
+    if (aosd->width <= 0 || aosd->height <= 0)
+      return;
+
+    /* on the same side of the wire as the frames it gets painted into */
+    retained->surface = cairo_surface_create_similar(cairo_get_target(cr),
+        CAIRO_CONTENT_COLOR_ALPHA, aosd->width, aosd->height);
+    if (cairo_surface_status(retained->surface) != CAIRO_STATUS_SUCCESS)
     {
-      aosd->mode = TRANSPARENCY_FAKE;
-      make_window(aosd);
+      free_retained(aosd);
+      run_renderer(aosd, renderer, cr);
       return;
     }
+
+    retained->width = aosd->width;
+    retained->height = aosd->height;
+    retained->renderer = *renderer;
   }
-  else
+
+  if (!retained->valid)
   {
-    aosd->win = XCreateWindow(dsp, root_win,
-        -1, -1, 1, 1, 0, CopyFromParent, InputOutput, CopyFromParent,
-        CWBackingStore | CWBackPixel | CWBackPixmap | CWBorderPixel |
-        CWEventMask | CWSaveUnder | CWOverrideRedirect, &att);
+    rcr = cairo_create(retained->surface);
+    cairo_set_operator(rcr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(rcr);
+    cairo_set_operator(rcr, CAIRO_OPERATOR_OVER);
+    run_renderer(aosd, renderer, rcr);
+    cairo_destroy(rcr);
+    retained->valid = True;
   }
 
-  set_window_properties(dsp, aosd->win);
-  if (aosd->width && aosd->height)
-    aosd_set_geometry(aosd, aosd->x, aosd->y, aosd->width, aosd->height);
-  if (aosd->shown)
-    aosd_show(aosd);
+  cairo_save(cr);
+  cairo_set_source_surface(cr, retained->surface, 0, 0);
+  if (alpha >= 1.0)
+    cairo_paint(cr);
+  else
+    cairo_paint_with_alpha(cr, alpha);
+  cairo_restore(cr);
 }
 
-Pixmap
-take_snapshot(Aosd* aosd)
+/* the renderer draws something else in rects now, everywhere for NULL;
+ * a retained copy that's still good gets just those redrawn */
+void
+damage_retained(Aosd* aosd, const XRectangle* rects, int n)
 {
-  Display* dsp = aosd->display;
-  Window root_win = aosd->root_win, win = aosd->win;
-  int width = aosd->width, height = aosd->height;
-  int scr = aosd->screen_num;
-  Pixmap pixmap;
-  GC gc;
+  AosdRetained* retained = &aosd->retained;
+  cairo_t* rcr;
+  int i;
 
-  /* create a pixmap to hold the screenshot */
-  pixmap = XCreatePixmap(dsp, win, width, height, DefaultDepth(dsp, scr));
+  if (rects == NULL || !retained->valid)
+  {
+    retained->valid = False;
+    return;
+  }
 
-  /* then copy the screen into the pixmap */
-  gc = XCreateGC(dsp, pixmap, 0, NULL);
-  XSetSubwindowMode(dsp, gc, IncludeInferiors);
-  XCopyArea(dsp, root_win, pixmap, gc, aosd->x, aosd->y, width, height, 0, 0);
-  XSetSubwindowMode(dsp, gc, ClipByChildren);
-  XFreeGC(dsp, gc);
+  rcr = cairo_create(retained->surface);
+  for (i = 0; i < n; i++)
+    cairo_rectangle(rcr,
+        rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+  cairo_clip(rcr);
 
-  return pixmap;
+  cairo_set_operator(rcr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint(rcr);
+  cairo_set_operator(rcr, CAIRO_OPERATOR_OVER);
+  run_renderer(aosd, &retained->renderer, rcr);
+  cairo_destroy(rcr);
 }
 
 void
-set_window_properties(Display* dsp, Window win)
+free_retained(Aosd* aosd)
 {
+  AosdRetained* retained = &aosd->retained;
+
+  if (retained->surface != NULL)
+    cairo_surface_destroy(retained->surface);
+
+  retained->surface = NULL;
+  retained->width = retained->height = 0;
+  retained->renderer.render_cb = NULL;
+  retained->renderer.data = NULL;
+  retained->valid = False;
+}
+
+void
+set_window_properties(Aosd* aosd)
+{
+  Display* dsp = aosd->display;
+  Window win = aosd->win;
+  Atom* atoms = aosd->context->atoms;
+
   /* we're almost a _NET_WM_WINDOW_TYPE_SPLASH, but we don't want
    * to be centered on the screen.  instead, manually request the
    * behavior we want. */
@@ -133,7 +2178,7 @@ set_window_properties(Display* dsp, Window win)
   /* turn off window decorations.
    * we could pull this in from a motif header, but it's easier to
    * use this snippet i found on a mailing list. */
-  Atom mwm_hints = XInternAtom(dsp, "_MOTIF_WM_HINTS", False);
+  Atom mwm_hints = atoms[ATOM_MOTIF_WM_HINTS];
   struct
   {
     long flags, functions, decorations, input_mode;
@@ -143,43 +2188,27 @@ set_window_properties(Display* dsp, Window win)
   XChangeProperty(dsp, win, mwm_hints, mwm_hints, 32,
       PropModeReplace, (unsigned char *)&mwm_hints_setting, 4);
 
-  Atom win_type = XInternAtom(dsp, "_NET_WM_WINDOW_TYPE", False);
+  Atom win_type = atoms[ATOM_NET_WM_WINDOW_TYPE];
   Atom win_type_notif[] = {
-    XInternAtom(dsp, "_NET_WM_WINDOW_TYPE_NOTIFICATION", False),
+    atoms[ATOM_NET_WM_WINDOW_TYPE_NOTIFICATION],
   };
   XChangeProperty(dsp, win, win_type, XA_ATOM, 32,
       PropModeReplace, (unsigned char *)&win_type_notif, 1);
 
   /* always on top, not in taskbar or pager. */
-  Atom win_state = XInternAtom(dsp, "_NET_WM_STATE", False);
+  Atom win_state = atoms[ATOM_NET_WM_STATE];
   Atom win_state_setting[] =
   {
-    XInternAtom(dsp, "_NET_WM_STATE_ABOVE", False),
-    XInternAtom(dsp, "_NET_WM_STATE_STICKY", False),
-    XInternAtom(dsp, "_NET_WM_STATE_SKIP_TASKBAR", False),
-    XInternAtom(dsp, "_NET_WM_STATE_SKIP_PAGER", False)
+    atoms[ATOM_NET_WM_STATE_ABOVE],
+    atoms[ATOM_NET_WM_STATE_STICKY],
+    atoms[ATOM_NET_WM_STATE_SKIP_TASKBAR],
+    atoms[ATOM_NET_WM_STATE_SKIP_PAGER]
   };
   XChangeProperty(dsp, win, win_state, XA_ATOM, 32,
       PropModeReplace, (unsigned char*)&win_state_setting, 3);
 }
 
 #ifdef HAVE_XCOMPOSITE
-Bool
-composite_check_ext_and_mgr(Display* dsp, int scr)
-{
-  int event_base, error_base;
-  Atom comp_manager_atom;
-  char comp_manager_hint[32];
-  
-  if (!XCompositeQueryExtension(dsp, &event_base, &error_base))
-    return False;
-
-  snprintf(comp_manager_hint, 32, "_NET_WM_CM_S%d", scr);
-  comp_manager_atom = XInternAtom(dsp, comp_manager_hint, False);
-
-  return (XGetSelectionOwner(dsp, comp_manager_atom) != None);
-}
-
 Visual*
 composite_find_argb_visual(Display* dsp, int scr)
 {
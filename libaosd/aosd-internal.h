@@ -10,6 +10,40 @@
 
 #include "config.h"
 
+#include <X11/extensions/Xrender.h>
+
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#endif
+
+#ifdef HAVE_XFIXES
+#include <X11/extensions/Xfixes.h>
+#endif
+
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
+
+#ifdef HAVE_XSYNC
+#include <X11/extensions/sync.h>
+#endif
+
+#ifdef HAVE_XPRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
+
+#ifdef HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
+#include <X11/Xresource.h>
+
 #include "aosd.h"
 
 typedef struct
@@ -24,14 +58,316 @@ typedef struct
   void* data;
 } MouseEventCallback;
 
+typedef struct
+{
+  AosdFrameCb frame_cb;
+  void* data;
+} FrameCallback;
+
+#define AOSD_DEFAULT_FPS 60
+
+/* aosd_flash_async()'s progress, advanced from the main loop */
+typedef struct
+{
+  Bool active;
+  AosdFadeMode fade;
+  /* microseconds, on the monotonic clock */
+  unsigned long long start, fade_in, full, fade_out;
+  /* of the last frame rendered */
+  float alpha;
+  /* the renderer's output changed since we took it */
+  Bool stale;
+  /* the user's renderer, while the flash has one of its own */
+  RenderCallback user_render;
+  /* FADE_RENDER's copy of the user's output */
+  cairo_surface_t* surface;
+  AosdFlashCb done_cb;
+  void* data;
+} AosdFlash;
+
+/* something else animating the OSD from the main loop, like a stack;
+ * tick runs once next has come and the previous frame is up, and
+ * returns when it wants to run again, 0 for never */
+typedef unsigned long long (*AosdTick)(Aosd*, void*);
+
+typedef struct
+{
+  AosdTick tick;
+  void* data;
+  unsigned long long next;
+} AosdTicker;
+
+/* deadline-driven frame clock for animations, times in microseconds */
+typedef struct
+{
+  unsigned int fps;
+  unsigned long long start, next;
+  unsigned int frame, dropped;
+} AosdClock;
+
+/* how long the windows below get to repaint before we take their
+ * picture again */
+#define SNAPSHOT_SETTLE_MS 250
+
 typedef struct
 {
   Pixmap pixmap;
+  /* client-side copy of the pixmap for RENDER_CLIENT */
+  XImage* image;
   Bool set;
+
+  /* screen area the snapshot holds; it's reused across show/hide
+   * for as long as nothing under it changes */
+  int x, y, width, height;
+  Bool valid;
+#ifdef HAVE_XDAMAGE
+  Damage damage;
+  int damage_event;
+  Bool damaged;
+#endif
 } AosdBackground;
 
+/* one half of the double-buffered backing store */
+typedef struct
+{
+  Pixmap pixmap;
+  GC gc;
+  Picture picture;
+  cairo_surface_t* surface;
+  /* still being read by a PresentPixmap request */
+  Bool busy;
+} AosdBuffer;
+
+/* server-side resources kept alive across renders;
+ * rebuilt only when size, depth or visual change */
+typedef struct
+{
+  AosdBuffer buffer[2];
+  int front;
+  XRenderPictFormat* xrformat;
+  int width, height;
+  unsigned int depth;
+  Visual* visual;
+  Bool set;
+  /* front buffer is the window background */
+  Bool presented;
+
+  /* client-side rasterization target for RENDER_CLIENT */
+  AosdRenderMode render_mode;
+  XImage* image;
+  cairo_surface_t* image_surface;
+#ifdef HAVE_XSHM
+  XShmSegmentInfo shminfo;
+  Bool shm;
+  int shm_completion;
+  Bool upload_pending;
+#endif
+} AosdResources;
+
+/* user's output rendered once and kept on the server */
+typedef struct
+{
+  Pixmap pixmap;
+  Picture picture;
+  int width, height;
+  Bool set;
+} AosdContent;
+
+/* retained mode's copy of the renderer's output, drawn again only
+ * when it's invalidated, resized or drawn by another renderer */
+typedef struct
+{
+  Bool enabled;
+  cairo_surface_t* surface;
+  int width, height;
+  RenderCallback renderer;
+  Bool valid;
+} AosdRetained;
+
+/* a display-less OSD draws here instead of into a window */
+typedef struct
+{
+  cairo_surface_t* surface;
+  /* the caller's pixels, if any */
+  unsigned char* data;
+  int width, height, stride;
+  /* stands in for the screen when positioning */
+  int screen_width, screen_height;
+} AosdOffscreen;
+
+/* frame pacing: the next frame slot opens when the server has shown
+ * the previous frame and the compositor has drawn it */
+typedef struct
+{
+  Bool present_pending;
+  Bool drawn_pending;
+  unsigned long long since;
+  unsigned long long ust, msc;
+#ifdef HAVE_XPRESENT
+  Bool present;
+  int present_opcode;
+  unsigned int serial;
+#endif
+#ifdef HAVE_XSYNC
+  /* _NET_WM_SYNC_REQUEST_COUNTER, basic and extended */
+  XSyncCounter counter[2];
+  unsigned long long counter_value;
+  Bool frame_sync;
+  int missed;
+#endif
+} AosdPacing;
+
+/* commands posted from other threads; see aosd-queue.c */
+typedef enum
+{
+  COMMAND_GEOMETRY,
+  COMMAND_POSITION,
+  COMMAND_SHOW,
+  COMMAND_HIDE,
+  COMMAND_RENDER,
+  COMMAND_FLASH,
+  COMMAND_CALL
+} AosdCommandType;
+
+typedef struct _AosdCommand AosdCommand;
+
+struct _AosdCommand
+{
+  AosdCommand* next;
+  Aosd* aosd;
+  AosdCommandType type;
+  int args[4];
+  AosdCall call;
+  void* data;
+  AosdDestroyNotify destroy;
+};
+
+typedef struct
+{
+  /* producers push at the head, the display's thread pops at the tail */
+  AosdCommand* head;
+  AosdCommand* tail;
+  AosdCommand stub;
+  /* popped, but not run yet */
+  AosdCommand* held;
+  int signalled;
+  Bool draining;
+  /* freed while draining */
+  Bool dying;
+  /* eventfd, or both ends of a pipe */
+  int fd[2];
+} AosdQueue;
+
+/* every atom we use, interned in one go per connection;
+ * the names live in aosd-internal.c */
+typedef enum
+{
+  ATOM_MOTIF_WM_HINTS = 0,
+  ATOM_NET_WM_WINDOW_TYPE,
+  ATOM_NET_WM_WINDOW_TYPE_NOTIFICATION,
+  ATOM_NET_WM_STATE,
+  ATOM_NET_WM_STATE_ABOVE,
+  ATOM_NET_WM_STATE_STICKY,
+  ATOM_NET_WM_STATE_SKIP_TASKBAR,
+  ATOM_NET_WM_STATE_SKIP_PAGER,
+  ATOM_NET_WM_WINDOW_OPACITY,
+  ATOM_NET_WM_SYNC_REQUEST,
+  ATOM_NET_WM_SYNC_REQUEST_COUNTER,
+  ATOM_NET_WM_FRAME_DRAWN,
+  ATOM_XROOTPMAP_ID,
+  ATOM_NET_SUPPORTED,
+  N_ATOMS
+} AosdAtom;
+
+/* extensions asked about up front, in the same batch as the atoms */
+typedef enum
+{
+  EXT_COMPOSITE = 0,
+  EXT_XFIXES,
+  EXT_DAMAGE,
+  EXT_SYNC,
+  EXT_PRESENT,
+  EXT_SHM,
+  EXT_RANDR,
+  N_EXTENSIONS
+} AosdExtension;
+
+/* lookups shared by every OSD on a screen */
+typedef struct
+{
+  /* _NET_WM_CM_Sn */
+  Atom cm_atom;
+
+  Bool probed;
+  Visual* argb_visual;
+  Colormap argb_colormap;
+  /* the Composite extension, a compositing manager running right now,
+   * and whether we get told when that changes */
+  Bool composite;
+  Bool cm_running;
+  Bool cm_watched;
+  /* the running compositor never answered frame sync, don't ask */
+  Bool no_frame_drawn;
+  /* _NET_SUPPORTED lists _NET_WM_WINDOW_OPACITY, looked up once per
+   * compositor */
+  Bool opacity_probed;
+  Bool opacity_supported;
+  /* OSDs that currently want root window events */
+  int root_watchers;
+  /* the monitor layout, fetched when first needed and again after it
+   * changed; always at least one monitor */
+  XRectangle* monitors;
+  int n_monitors;
+  int primary;
+  Bool monitors_valid;
+  Bool monitors_watched;
+} AosdScreen;
+
+struct _AosdContext
+{
+  Display* display;
+  /* our windows and buffers, mapped to the Aosd they belong to */
+  XContext ids;
+  Atom atoms[N_ATOMS];
+  int n_screens;
+  AosdScreen* screens;
+  Aosd* osds;
+  AosdQueue* queue;
+#ifdef HAVE_XPRESENT
+  int present_opcode;
+#endif
+#ifdef HAVE_XSHM
+  int shm_completion;
+#endif
+#ifdef HAVE_XSYNC
+  Bool sync_probed;
+  Bool sync;
+#endif
+#ifdef HAVE_XFIXES
+  /* 0 until probed, -1 without XFixes */
+  int xfixes_event;
+#endif
+#ifdef HAVE_XRANDR
+  /* 0 until probed, -1 without RandR 1.5 */
+  int randr_event;
+#endif
+#ifdef HAVE_XCB
+  /* the same connection, for requests we'd rather not wait on */
+  xcb_connection_t* xcb;
+  xcb_query_extension_cookie_t ext_cookie[N_EXTENSIONS];
+  /* -1 while the reply is still outstanding */
+  int ext_present[N_EXTENSIONS];
+#endif
+};
+
 struct _Aosd
 {
+  AosdContext* context;
+  Aosd* next;
+  Bool own_context;
+  /* the context's, or a headless OSD's own */
+  AosdQueue* queue;
+
   Display* display;
   int screen_num;
   unsigned int depth;
@@ -40,22 +376,111 @@ struct _Aosd
   Visual* visual;
   Colormap colormap;
   int x, y, width, height;
+  /* what positioning is relative to, see AosdMonitor */
+  int monitor;
+  /* WM_CLASS, kept here so a new window can get it back */
+  char* res_name;
+  char* res_class;
 
   AosdBackground background;
+  AosdResources resources;
+  AosdContent content;
+  AosdRetained retained;
+  AosdPacing pacing;
+  AosdClock clock;
+  AosdFlash flash;
+  AosdTicker ticker;
   RenderCallback renderer;
+  /* what the user asked for; mode is what we can do right now */
+  AosdTransparency requested_mode;
   AosdTransparency mode;
+  /* a window that stepped aside to let the screen below repaint */
+  unsigned long long remap;
+  AosdRenderMode render_mode;
+  AosdFadeMode fade_mode;
   MouseEventCallback mouse_processor;
+  FrameCallback animator;
+
+  /* no display, no window: frames land in offscreen */
+  Bool headless;
+  AosdOffscreen offscreen;
 
   Bool mouse_hide;
   Bool shown;
+
+  AosdStats stats;
+  /* the request the outermost stats_begin() saw coming next */
+  unsigned long stats_serial;
+  int stats_depth;
 };
 
+void intern_atoms(AosdContext*);
+Bool has_extension(AosdContext*, AosdExtension);
+void discard_probes(AosdContext*);
+AosdScreen* get_screen(Aosd*);
+void free_screens(AosdContext*);
+void register_id(Aosd*, XID);
+void unregister_id(Aosd*, XID);
+Aosd* find_osd(AosdContext*, XEvent*);
+void watch_root(Aosd*);
+void unwatch_root(Aosd*);
+Bool composite_handle_event(AosdContext*, XEvent*);
+void composite_tick(Aosd*);
+void frame_sync_unanswered(Aosd*);
+Bool window_opacity_supported(Aosd*);
+int monitor_count(Aosd*);
+void monitor_geometry(Aosd*, int, XRectangle*);
+Bool monitors_handle_event(AosdContext*, XEvent*);
+
 void make_window(Aosd*);
-void set_window_properties(Display*, Window);
-Pixmap take_snapshot(Aosd*);
+void set_window_properties(Aosd*);
+void update_snapshot(Aosd*);
+void move_snapshot(Aosd*, int, int, int, int);
+void snapshot_hidden(Aosd*);
+Bool snapshot_handle_event(Aosd*, XEvent*);
+void free_background(Aosd*);
+
+cairo_surface_t* create_surface(Aosd*, Drawable, XRenderPictFormat*,
+    int, int);
+Bool make_resources(Aosd*);
+void free_resources(Aosd*);
+void swap_buffers(Aosd*);
+
+void present_buffer(Aosd*, AosdBuffer*);
+
+Bool make_content(Aosd*);
+void free_content(Aosd*);
+void present_content(Aosd*, float);
+void set_window_opacity(Aosd*, float);
+void unset_window_opacity(Aosd*);
+Bool pacing_handle_event(Aosd*, XEvent*);
+unsigned long long get_time_us(void);
+void wait_for_buffer(Aosd*, AosdBuffer*);
+void flash_stop(Aosd*, Bool);
+
+void stats_record(AosdHistogram*, unsigned long long);
+void stats_begin(Aosd*);
+void stats_end(Aosd*);
+void call_renderer(Aosd*, cairo_t*);
+
+void paint_retained(Aosd*, cairo_t*, RenderCallback*, double);
+void damage_retained(Aosd*, const XRectangle*, int);
+void free_retained(Aosd*);
+
+void server_background(Aosd*, AosdBuffer*, const XRectangle*, int);
+void client_background(Aosd*, const XRectangle*, int);
+void upload_image(Aosd*, AosdBuffer*, const XRectangle*, int);
+void wait_for_upload(Aosd*);
+
+Bool make_offscreen(Aosd*);
+void free_offscreen(Aosd*);
+
+AosdQueue* queue_new(void);
+Bool queue_drain(AosdQueue*);
+void queue_forget(AosdQueue*, Aosd*);
+void queue_free(AosdQueue*);
 
 #ifdef HAVE_XCOMPOSITE
-Bool composite_check_ext_and_mgr(Display*, int);
 Visual* composite_find_argb_visual(Display*, int);
 #endif
 
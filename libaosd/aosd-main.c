@@ -13,33 +13,74 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <time.h>
 #include <sys/poll.h>
-#include <sys/time.h>
 
 #include <X11/Xlib.h>
 
 #include "aosd-internal.h"
 
+/* how long we trust the server or compositor to report a finished frame */
+#define FRAME_TIMEOUT_MS 100
+
+static unsigned long long paced_deadline(Aosd* aosd, unsigned long long due);
+static void flash_tick(Aosd* aosd);
+static void ticker_tick(Aosd* aosd);
+
 static void
-aosd_loop_iteration(Aosd* aosd)
+handle_button(Aosd* aosd, XEvent* ev)
+{
+  if (aosd->mouse_hide)
+    aosd_hide(aosd);
+
+  /* create AosdMouseEvent and pass it to callback function */
+  if (aosd->mouse_processor.mouse_event_cb != NULL)
+  {
+    AosdMouseEvent mev;
+    mev.x = ev->xbutton.x;
+    mev.y = ev->xbutton.y;
+    mev.x_root = ev->xbutton.x_root;
+    mev.y_root = ev->xbutton.y_root;
+    mev.button = ev->xbutton.button;
+    mev.send_event = ev->xbutton.send_event;
+    mev.time = ev->xbutton.time;
+    aosd->mouse_processor.mouse_event_cb(&mev, aosd->mouse_processor.data);
+  }
+}
+
+static void
+handle_event(Aosd* aosd, XEvent* event)
 {
   Display* dsp = aosd->display;
-  XEvent ev, pev;
-  XNextEvent(dsp, &ev);
+  XEvent ev = *event, pev;
+
+  if (pacing_handle_event(aosd, &ev) ||
+      snapshot_handle_event(aosd, &ev))
+    return;
 
   /* smash multiple configure/exposes into one. */
   if (ev.type == ConfigureNotify ||
       ev.type == Expose)
   {
-    while (XPending(dsp))
+    while (XEventsQueued(dsp, QueuedAlready))
     {
       XPeekEvent(dsp, &pev);
-      if (pev.type != ev.type)
+      if (pev.type != ev.type || pev.xany.window != ev.xany.window)
         break;
       XNextEvent(dsp, &ev);
     }
   }
 
+#ifdef HAVE_XSHM
+  /* the server is done reading our shared image */
+  if (ev.type == aosd->resources.shm_completion &&
+      aosd->resources.upload_pending)
+  {
+    aosd->resources.upload_pending = False;
+    return;
+  }
+#endif
+
   switch (ev.type)
   {
     case Expose:
@@ -56,104 +97,470 @@ aosd_loop_iteration(Aosd* aosd)
               aosd->x, aosd->y, aosd->width, aosd->height);
       }
       break;
+  }
+}
 
-    case ButtonPress:
-      if (aosd->mouse_hide)
-        aosd_hide(aosd);
+static void
+aosd_handle_event(Aosd* aosd, XEvent* event)
+{
+  aosd->stats.events++;
 
-      /* create AosdMouseEvent and pass it to callback function */
-      if (aosd->mouse_processor.mouse_event_cb != NULL)
+  /* the mouse callback may destroy the OSD, don't hold on to it */
+  if (event->type == ButtonPress)
+  {
+    handle_button(aosd, event);
+    return;
+  }
+
+  stats_begin(aosd);
+  handle_event(aosd, event);
+  stats_end(aosd);
+}
+
+/* takes one event off the connection and hands it to its OSD */
+static void
+context_next_event(AosdContext* ctx)
+{
+  Display* dsp = ctx->display;
+  XEvent ev;
+  Aosd* aosd;
+  Bool cookie;
+
+  XNextEvent(dsp, &ev);
+
+  /* fetched once here, whichever OSD ends up looking at it */
+  cookie = (ev.type == GenericEvent && XGetEventData(dsp, &ev.xcookie));
+
+  /* compositors and monitors coming and going concern every OSD on
+   * the screen */
+  if (composite_handle_event(ctx, &ev) ||
+      monitors_handle_event(ctx, &ev))
+    ;
+  else if ((aosd = find_osd(ctx, &ev)) != NULL)
+    aosd_handle_event(aosd, &ev);
+  else
+  {
+    /* root window and extension events, each OSD picks its own */
+    for (aosd = ctx->osds; aosd != NULL; aosd = aosd->next)
+      if (pacing_handle_event(aosd, &ev))
       {
-        AosdMouseEvent mev;
-        mev.x = ev.xbutton.x;
-        mev.y = ev.xbutton.y;
-        mev.x_root = ev.xbutton.x_root;
-        mev.y_root = ev.xbutton.y_root;
-        mev.button = ev.xbutton.button;
-        mev.send_event = ev.xbutton.send_event;
-        mev.time = ev.xbutton.time;
-        aosd->mouse_processor.mouse_event_cb(&mev, aosd->mouse_processor.data);
+        aosd->stats.events++;
+        break;
       }
-      break;
+    for (aosd = ctx->osds; aosd != NULL; aosd = aosd->next)
+    {
+      stats_begin(aosd);
+      if (snapshot_handle_event(aosd, &ev))
+        aosd->stats.events++;
+      stats_end(aosd);
+    }
   }
+
+  if (cookie)
+    XFreeEventData(dsp, &ev.xcookie);
+}
+
+int
+aosd_context_get_fd(AosdContext* ctx)
+{
+  if (ctx == NULL)
+    return -1;
+
+  return ConnectionNumber(ctx->display);
 }
 
 void
-aosd_loop_once(Aosd* aosd)
+aosd_context_flush(AosdContext* ctx)
+{
+  if (ctx == NULL)
+    return;
+
+  XFlush(ctx->display);
+}
+
+int
+aosd_get_fd(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return -1;
+
+  return aosd_context_get_fd(aosd->context);
+}
+
+void
+aosd_flush(Aosd* aosd)
 {
   if (aosd == NULL)
     return;
 
+  aosd_context_flush(aosd->context);
+}
+
+void
+aosd_sync(Aosd* aosd)
+{
+  if (aosd == NULL || aosd->headless)
+    return;
+
+  stats_begin(aosd);
   XSync(aosd->display, False);
+  aosd->stats.round_trips++;
+  stats_end(aosd);
+}
+
+/* earliest time the OSD has something due without any event coming in,
+ * 0 if never */
+static unsigned long long
+osd_deadline(Aosd* aosd)
+{
+  unsigned long long deadline = 0, t;
+
+  if (aosd->remap != 0)
+    deadline = aosd->remap;
+
+  t = paced_deadline(aosd, aosd->flash.active ? aosd->clock.next : 0);
+  if (t != 0 && (deadline == 0 || t < deadline))
+    deadline = t;
+
+  t = paced_deadline(aosd, aosd->ticker.next);
+  if (t != 0 && (deadline == 0 || t < deadline))
+    deadline = t;
+
+  return deadline;
+}
+
+static unsigned long long
+next_deadline(AosdContext* ctx)
+{
+  unsigned long long deadline = 0, t;
+  Aosd* aosd;
+
+  for (aosd = ctx->osds; aosd != NULL; aosd = aosd->next)
+  {
+    t = osd_deadline(aosd);
+    if (t != 0 && (deadline == 0 || t < deadline))
+      deadline = t;
+  }
+
+  return deadline;
+}
+
+static int
+deadline_timeout(unsigned long long deadline)
+{
+  unsigned long long now;
+
+  if (deadline == 0)
+    return -1;
+
+  now = get_time_us();
+  if (now >= deadline)
+    return 0;
 
-  while (XPending(aosd->display))
-    aosd_loop_iteration(aosd);
+  /* round up, or the caller spins through the last millisecond */
+  return (deadline - now + 999) / 1000;
+}
+
+int
+aosd_context_get_timeout(AosdContext* ctx)
+{
+  if (ctx == NULL)
+    return -1;
+
+  /* events Xlib already read off the socket won't wake up a poll() */
+  if (XEventsQueued(ctx->display, QueuedAlready) > 0)
+    return 0;
+
+  return deadline_timeout(next_deadline(ctx));
+}
+
+int
+aosd_get_timeout(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return -1;
+
+  if (aosd->headless)
+    return deadline_timeout(osd_deadline(aosd));
+
+  return aosd_context_get_timeout(aosd->context);
 }
 
 void
-aosd_loop_for(Aosd* aosd, unsigned loop_ms)
+aosd_context_dispatch(AosdContext* ctx)
+{
+  Aosd *aosd, *next;
+
+  if (ctx == NULL)
+    return;
+
+  /* what other threads posted goes first, then the X side of it;
+   * a posted call may have destroyed the context */
+  if (!queue_drain(ctx->queue))
+    return;
+
+  /* reads whatever the socket has, but never writes or waits */
+  while (XEventsQueued(ctx->display, QueuedAfterReading) > 0)
+    context_next_event(ctx);
+
+  /* a flash that ends may take its OSD along */
+  for (aosd = ctx->osds; aosd != NULL; aosd = next)
+  {
+    next = aosd->next;
+    stats_begin(aosd);
+    composite_tick(aosd);
+    stats_end(aosd);
+    flash_tick(aosd);
+    ticker_tick(aosd);
+  }
+}
+
+void
+aosd_dispatch(Aosd* aosd)
 {
   if (aosd == NULL)
     return;
 
-  aosd_loop_once(aosd);
+  if (aosd->headless)
+  {
+    if (!queue_drain(aosd->queue))
+      return;
+    flash_tick(aosd);
+    ticker_tick(aosd);
+  }
+  else
+    aosd_context_dispatch(aosd->context);
+}
 
-  if (loop_ms == 0 || !aosd->shown)
+void
+aosd_loop_once(Aosd* aosd)
+{
+  if (aosd == NULL)
     return;
 
-  struct timeval tv_now;
-  struct timeval tv_until;
-  gettimeofday(&tv_until, NULL);
-  tv_until.tv_usec += loop_ms * 1000;
+  if (!aosd->headless)
+    XFlush(aosd->display);
+  aosd_dispatch(aosd);
+}
+
+unsigned long long
+get_time_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* sleeps until there's something to read or the timeout passes */
+static Bool
+loop_wait(Aosd* aosd, int timeout)
+{
+  /* the connection, unless we're headless, and posted commands,
+   * unless we're running one of them right now */
+  struct pollfd pollfds[2];
+  int n = 0;
 
+  if (!aosd->headless)
+  {
+    pollfds[n].fd = ConnectionNumber(aosd->display);
+    pollfds[n].events = POLLIN;
+    pollfds[n++].revents = 0;
+    XFlush(aosd->display);
+  }
+  if (!aosd->queue->draining)
+  {
+    pollfds[n].fd = aosd->queue->fd[0];
+    pollfds[n].events = POLLIN;
+    pollfds[n++].revents = 0;
+  }
+
+  int ret = poll(pollfds, n, timeout);
+
+  if (ret < 0 && errno != EINTR)
+  {
+    perror("poll");
+    abort();
+  }
+
+  return ret > 0;
+}
+
+static void
+aosd_loop_until(Aosd* aosd, unsigned long long until)
+{
   for (;;)
   {
-    gettimeofday(&tv_now, NULL);
-    int dt = (tv_until.tv_sec  - tv_now.tv_sec ) * 1000 +
-             (tv_until.tv_usec - tv_now.tv_usec) / 1000;
-    if (dt <= 0 || !aosd->shown)
+    unsigned long long now = get_time_us();
+    if (now >= until || !aosd->shown)
       break;
 
-    struct pollfd pollfd = { ConnectionNumber(aosd->display), POLLIN, 0 };
-    int ret = poll(&pollfd, 1, dt);
+    /* round up, or we'd spin through the last millisecond */
+    if (loop_wait(aosd, (until - now + 999) / 1000))
+      aosd_loop_once(aosd);
+  }
+}
 
-    if (ret == 0)
-      break;
+void
+aosd_loop_for(Aosd* aosd, unsigned loop_ms)
+{
+  if (aosd == NULL)
+    return;
 
-    if (ret < 0)
+  aosd_loop_once(aosd);
+
+  if (loop_ms == 0 || !aosd->shown)
+    return;
+
+  aosd_loop_until(aosd, get_time_us() + loop_ms * 1000ULL);
+}
+
+#ifdef HAVE_XPRESENT
+static Bool
+is_present_event(Display* dsp, XEvent* ev, XPointer arg)
+{
+  AosdContext* ctx = (AosdContext*)arg;
+
+  (void)dsp;
+  return ev->type == GenericEvent &&
+    ev->xgeneric.extension == ctx->present_opcode;
+}
+#endif
+
+/* waits for the server to let go of buf, or for us to give up on it.
+ * only Present's events are taken off the queue meanwhile, everything
+ * else stays there for the next dispatch: running callbacks in the
+ * middle of a render could have them destroy the OSD under us */
+void
+wait_for_buffer(Aosd* aosd, AosdBuffer* buf)
+{
+#ifdef HAVE_XPRESENT
+  Display* dsp = aosd->display;
+  AosdContext* ctx = aosd->context;
+  unsigned long long since = aosd->pacing.since;
+  XEvent ev;
+  Aosd* osd;
+
+  if (!buf->busy)
+    return;
+
+  XFlush(dsp);
+
+  while (buf->busy)
+  {
+    if (XCheckIfEvent(dsp, &ev, is_present_event, (XPointer)ctx))
     {
-      if (errno != EINTR)
+      /* the other OSDs' frames finish meanwhile too */
+      Bool cookie = XGetEventData(dsp, &ev.xcookie);
+      if ((osd = find_osd(ctx, &ev)) != NULL)
       {
-        perror("poll");
-        abort();
+        pacing_handle_event(osd, &ev);
+        osd->stats.events++;
       }
+      if (cookie)
+        XFreeEventData(dsp, &ev.xcookie);
+      continue;
+    }
+
+    int dt = FRAME_TIMEOUT_MS - (int)((get_time_us() - since) / 1000);
+    if (dt <= 0)
+    {
+      buf->busy = False;
+      return;
+    }
+
+    struct pollfd pollfd = { ConnectionNumber(dsp), POLLIN, 0 };
+    if (poll(&pollfd, 1, dt) < 0 && errno != EINTR)
+    {
+      perror("poll");
+      abort();
     }
-    else
-      aosd_loop_once(aosd);
   }
+#else
+  (void)aosd;
+  buf->busy = False;
+#endif
 }
 
-typedef struct
+static void
+clock_start(Aosd* aosd)
 {
-  int width, height;
-  cairo_surface_t* surface;
-  float alpha;
-  RenderCallback user_render;
-} AosdFlashData;
+  AosdClock* clock = &aosd->clock;
+
+  clock->start = clock->next = get_time_us();
+  clock->frame = clock->dropped = 0;
+}
+
+/* counts the frame slots a late frame missed and opens the next one */
+static void
+clock_advance(Aosd* aosd, unsigned long long now)
+{
+  AosdClock* clock = &aosd->clock;
+  unsigned long long period = clock->fps ? 1000000ULL / clock->fps : 0;
+
+  if (period != 0 && now >= clock->next)
+  {
+    /* a render overran its slot, drop the frames we missed */
+    unsigned long long missed = (now - clock->next) / period;
+    clock->dropped += missed;
+    aosd->stats.frames_dropped += missed;
+    clock->next += (missed + 1) * period;
+  }
+}
+
+/* never start a frame before the previous one is on screen, unless
+ * we gave up on hearing about it */
+static Bool
+frame_ready(Aosd* aosd)
+{
+  AosdPacing* pacing = &aosd->pacing;
+  Bool expired =
+    get_time_us() - pacing->since >= FRAME_TIMEOUT_MS * 1000ULL;
+
+  if (pacing->present_pending)
+  {
+    if (!expired)
+      return False;
+    pacing->present_pending = False;
+  }
+
+#ifdef HAVE_XSYNC
+  if (pacing->drawn_pending)
+  {
+    if (!expired)
+      return False;
+
+    /* the compositor doesn't do frame sync for us, stop asking */
+    pacing->drawn_pending = False;
+    if (++pacing->missed >= 3)
+      frame_sync_unanswered(aosd);
+  }
+#endif
+
+  return True;
+}
 
 static void
 flash_render(cairo_t* cr, void* data)
 {
-  AosdFlashData* flash = data;
+  Aosd* aosd = data;
+  AosdFlash* flash = &aosd->flash;
+
+  /* the OSD keeps a copy of the output anyway */
+  if (aosd->retained.enabled)
+  {
+    paint_retained(aosd, cr, &flash->user_render, flash->alpha);
+    return;
+  }
 
   /* the first time we render, let the client render into their own surface */
   if (flash->surface == NULL)
   {
     cairo_t* rendered_cr;
     flash->surface = cairo_surface_create_similar(cairo_get_target(cr),
-        CAIRO_CONTENT_COLOR_ALPHA, flash->width, flash->height);
+        CAIRO_CONTENT_COLOR_ALPHA, aosd->width, aosd->height);
     rendered_cr = cairo_create(flash->surface);
-    flash->user_render.render_cb(rendered_cr, flash->user_render.data);
+    if (flash->user_render.render_cb != NULL)
+      flash->user_render.render_cb(rendered_cr, flash->user_render.data);
     cairo_destroy(rendered_cr);
   }
 
@@ -163,72 +570,307 @@ flash_render(cairo_t* cr, void* data)
   cairo_paint_with_alpha(cr, flash->alpha);
 }
 
-void
-aosd_flash(Aosd* aosd,
-    unsigned fade_in_ms, unsigned full_ms, unsigned fade_out_ms)
+static AosdFadeMode
+choose_fade(Aosd* aosd)
 {
-  if (aosd == NULL ||
-      (fade_in_ms == 0 &&
-       full_ms == 0 &&
-       fade_out_ms == 0))
-    return;
+  AosdFadeMode fade = aosd->fade_mode;
 
-  AosdFlashData flash = {0};
-  memcpy(&flash.user_render, &aosd->renderer, sizeof(RenderCallback));
-  aosd_set_renderer(aosd, flash_render, &flash);
-  flash.alpha = 0;
-  flash.width = aosd->width;
-  flash.height = aosd->height;
+  /* the other two need a server */
+  if (aosd->headless)
+    return FADE_RENDER;
 
-  float step;
+  /* window opacity means nothing without a compositor, and FADE_AUTO
+   * doesn't bet on one that doesn't say it honours it */
+  if ((fade == FADE_AUTO || fade == FADE_OPACITY) &&
+      aosd->mode != TRANSPARENCY_COMPOSITE)
+    fade = FADE_XRENDER;
+  else if (fade == FADE_AUTO)
+    fade = window_opacity_supported(aosd) ? FADE_OPACITY : FADE_XRENDER;
 
-  if (!aosd->shown)
+  return fade;
+}
+
+/* the renderer draws something else now, have the fade pick it up */
+static void
+flash_refresh(Aosd* aosd)
+{
+  AosdFlash* flash = &aosd->flash;
+
+  flash->stale = False;
+
+  switch (flash->fade)
   {
-    aosd_show(aosd);
-    aosd_loop_once(aosd);
+    case FADE_OPACITY:
+      aosd_render(aosd);
+      break;
+
+    case FADE_XRENDER:
+      free_content(aosd);
+      aosd->renderer = flash->user_render;
+      make_content(aosd);
+      aosd->renderer.render_cb = NULL;
+      aosd->renderer.data = NULL;
+      break;
+
+    default:
+      if (flash->surface != NULL)
+      {
+        cairo_surface_destroy(flash->surface);
+        flash->surface = NULL;
+      }
+      break;
   }
+}
+
+/* when a frame due at the given time can actually start */
+static unsigned long long
+paced_deadline(Aosd* aosd, unsigned long long due)
+{
+  AosdPacing* pacing = &aosd->pacing;
+
+  if (due == 0)
+    return 0;
 
-  if (fade_in_ms != 0 && aosd->shown)
+  /* the event saying the last frame is up wakes us sooner than this */
+  if (pacing->present_pending || pacing->drawn_pending)
+    return pacing->since + FRAME_TIMEOUT_MS * 1000ULL;
+
+  return due;
+}
+
+/* renders the flash's next frame once it's due */
+static void
+flash_tick(Aosd* aosd)
+{
+  AosdFlash* flash = &aosd->flash;
+  unsigned long long now, t;
+  float alpha;
+
+  if (!flash->active || !frame_ready(aosd))
+    return;
+
+  now = get_time_us();
+  if (now < aosd->clock.next)
+    return;
+
+  t = now - flash->start;
+
+  if (t < flash->fade_in)
+    alpha = t / (float)flash->fade_in;
+  else if (t < flash->fade_in + flash->full)
+    alpha = 1.0;
+  else if (t < flash->fade_in + flash->full + flash->fade_out)
+    alpha = 1.0 - (t - flash->fade_in - flash->full) / (float)flash->fade_out;
+  else
   {
-    step = 1.0 / (float)fade_in_ms;
-    for (; flash.alpha < 1.0 && aosd->shown; flash.alpha += step)
-    {
-      aosd_render(aosd);
-      aosd_loop_for(aosd, step);
-    }
+    flash_stop(aosd, True);
+    return;
   }
 
-  flash.alpha = 1.0;
+  /* what's left can't end the flash, nor take the OSD along */
+  stats_begin(aosd);
 
-  if (full_ms != 0 && aosd->shown)
+  if (flash->stale)
+    flash_refresh(aosd);
+  else if (alpha == 1.0 && flash->alpha == 1.0)
   {
-    aosd_render(aosd);
-    aosd_loop_for(aosd, full_ms);
+    /* fully opaque frame is already up, nothing to animate */
+    aosd->clock.next = flash->start + flash->fade_in + flash->full;
+    stats_end(aosd);
+    return;
   }
 
-  if (fade_out_ms != 0 && aosd->shown)
+  clock_advance(aosd, now);
+  flash->alpha = alpha;
+
+  if (aosd->animator.frame_cb != NULL)
   {
-    step = 1.0 / (float)fade_out_ms;
-    for (; flash.alpha > 0.0 && aosd->shown; flash.alpha -= step)
-    {
-      aosd_render(aosd);
-      aosd_loop_for(aosd, step);
-    }
+    AosdFrame frame;
+    frame.time_us = now;
+    frame.frame = aosd->clock.frame;
+    frame.dropped = aosd->clock.dropped;
+    frame.alpha = alpha;
+    aosd->animator.frame_cb(&frame, aosd->animator.data);
   }
 
+  if (flash->fade == FADE_OPACITY)
+    set_window_opacity(aosd, alpha);
+  else if (flash->fade == FADE_XRENDER)
+    present_content(aosd, alpha);
+  else
+    aosd_render(aosd);
+
+  aosd->clock.frame++;
+  aosd->stats.frames++;
+  stats_end(aosd);
+}
+
+static void
+ticker_tick(Aosd* aosd)
+{
+  AosdTicker* ticker = &aosd->ticker;
+  unsigned long long next;
+
+  if (ticker->tick == NULL || ticker->next == 0 ||
+      get_time_us() < ticker->next || !frame_ready(aosd))
+    return;
+
+  /* the tick may ask for an earlier run itself, through ticker->next */
+  ticker->next = 0;
+  stats_begin(aosd);
+  next = ticker->tick(aosd, ticker->data);
+  stats_end(aosd);
+  if (next != 0 && (ticker->next == 0 || next < ticker->next))
+    ticker->next = next;
+}
+
+void
+flash_stop(Aosd* aosd, Bool completed)
+{
+  AosdFlash* flash = &aosd->flash;
+  AosdFlashCb done_cb = flash->done_cb;
+  void* data = flash->data;
+
+  if (!flash->active)
+    return;
+
+  flash->active = False;
   if (aosd->shown)
-  {
     aosd_hide(aosd);
-    aosd_loop_once(aosd);
-  }
 
   /* restore initial renderer */
-  aosd_set_renderer(aosd,
-      flash.user_render.render_cb,
-      flash.user_render.data);
+  aosd->renderer = flash->user_render;
 
   /* free some resources */
-  cairo_surface_destroy(flash.surface);
+  if (flash->fade == FADE_OPACITY)
+    unset_window_opacity(aosd);
+  free_content(aosd);
+  if (flash->surface != NULL)
+  {
+    cairo_surface_destroy(flash->surface);
+    flash->surface = NULL;
+  }
+
+  if (done_cb != NULL)
+    done_cb(aosd, completed, data);
+}
+
+void
+aosd_flash_async(Aosd* aosd,
+    unsigned fade_in_ms, unsigned full_ms, unsigned fade_out_ms,
+    AosdFlashCb done_cb, void* user_data)
+{
+  if (aosd == NULL ||
+      (fade_in_ms == 0 &&
+       full_ms == 0 &&
+       fade_out_ms == 0))
+    return;
+
+  AosdFlash* flash = &aosd->flash;
+
+  /* one that's already running carries on from where it is */
+  if (flash->active)
+  {
+    AosdFlashCb old_cb = flash->done_cb;
+    void* old_data = flash->data;
+
+    flash->done_cb = done_cb;
+    flash->data = user_data;
+    flash->fade_in = fade_in_ms * 1000ULL;
+    aosd_flash_retarget(aosd, full_ms, fade_out_ms);
+
+    if (old_cb != NULL)
+      old_cb(aosd, False, old_data);
+    return;
+  }
+
+  flash->fade = choose_fade(aosd);
+  flash->user_render = aosd->renderer;
+  flash->alpha = 0;
+  flash->stale = False;
+  flash->done_cb = done_cb;
+  flash->data = user_data;
+  flash->fade_in = fade_in_ms * 1000ULL;
+  flash->full = full_ms * 1000ULL;
+  flash->fade_out = fade_out_ms * 1000ULL;
+
+  switch (flash->fade)
+  {
+    case FADE_OPACITY:
+      /* the content is rendered as usual, the compositor fades it */
+      set_window_opacity(aosd, 0.0);
+      break;
+
+    case FADE_XRENDER:
+      /* render the content once, the window only shows the background
+       * until the first frame blends it in */
+      make_content(aosd);
+      aosd->renderer.render_cb = NULL;
+      aosd->renderer.data = NULL;
+      break;
+
+    default:
+      aosd->renderer.render_cb = flash_render;
+      aosd->renderer.data = aosd;
+      break;
+  }
+
+  flash->active = True;
+  if (!aosd->shown)
+    aosd_show(aosd);
+
+  /* alpha follows the monotonic clock, so the flash takes its nominal
+   * time however fast we render, and costs at most one render per
+   * frame slot */
+  clock_start(aosd);
+  flash->start = aosd->clock.start;
+}
+
+void
+aosd_flash_retarget(Aosd* aosd, unsigned full_ms, unsigned fade_out_ms)
+{
+  if (aosd == NULL || !aosd->flash.active)
+    return;
+
+  AosdFlash* flash = &aosd->flash;
+  unsigned long long now = get_time_us();
+
+  flash->full = full_ms * 1000ULL;
+  flash->fade_out = fade_out_ms * 1000ULL;
+
+  /* fade back in from wherever we are, then hold and fade out anew;
+   * the renderer may well draw something else by now */
+  flash->start = now - (unsigned long long)(flash->alpha * flash->fade_in);
+  flash->stale = True;
+  aosd->clock.next = now;
+}
+
+void
+aosd_flash_cancel(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return;
+
+  flash_stop(aosd, False);
+}
+
+void
+aosd_flash(Aosd* aosd,
+    unsigned fade_in_ms, unsigned full_ms, unsigned fade_out_ms)
+{
+  if (aosd == NULL)
+    return;
+
+  aosd_flash_async(aosd, fade_in_ms, full_ms, fade_out_ms, NULL, NULL);
+
+  /* the same machinery, we just don't return before it's done */
+  while (aosd->flash.active)
+  {
+    loop_wait(aosd, aosd_get_timeout(aosd));
+    aosd_loop_once(aosd);
+  }
+
+  aosd_flush(aosd);
 }
 
 /* vim: set ts=2 sw=2 et : */
@@ -0,0 +1,426 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * Thread-safe front end: commands posted from any thread, run by the
+ * one driving the display.
+ *
+ * The queue is Dmitry Vyukov's intrusive MPSC queue.  Posting is a
+ * single atomic exchange, so producers never block, on X or on each
+ * other; the consumer side is only ever touched by the display's
+ * thread.  A wakeup is written at most once per drain, however many
+ * commands come in meanwhile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "aosd-internal.h"
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+AosdQueue*
+queue_new(void)
+{
+  AosdQueue* q = calloc(1, sizeof(AosdQueue));
+
+  q->head = q->tail = &q->stub;
+
+#ifdef HAVE_SYS_EVENTFD_H
+  q->fd[0] = q->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (q->fd[0] < 0)
+#endif
+  {
+    if (pipe(q->fd) < 0)
+    {
+      perror("pipe");
+      abort();
+    }
+
+    fcntl(q->fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(q->fd[1], F_SETFL, O_NONBLOCK);
+    fcntl(q->fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(q->fd[1], F_SETFD, FD_CLOEXEC);
+  }
+
+  return q;
+}
+
+static void
+queue_link(AosdQueue* q, AosdCommand* cmd)
+{
+  AosdCommand* prev;
+
+  cmd->next = NULL;
+  prev = __atomic_exchange_n(&q->head, cmd, __ATOMIC_ACQ_REL);
+  /* until this store lands the consumer sees the queue end at prev */
+  __atomic_store_n(&prev->next, cmd, __ATOMIC_RELEASE);
+}
+
+static AosdCommand*
+queue_pop(AosdQueue* q)
+{
+  AosdCommand* tail = q->tail;
+  AosdCommand* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+  if (tail == &q->stub)
+  {
+    if (next == NULL)
+      return NULL;
+
+    q->tail = tail = next;
+    next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+  }
+
+  if (next != NULL)
+  {
+    q->tail = next;
+    return tail;
+  }
+
+  /* a producer is between its exchange and its link; it signals once
+   * it's done, so leave the rest for the next drain */
+  if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  /* tail is the last one, put the stub behind it so we can take it */
+  queue_link(q, &q->stub);
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (next != NULL)
+  {
+    q->tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+static Bool
+queue_push(AosdQueue* q, AosdCommand* cmd)
+{
+  if (cmd == NULL)
+    return False;
+
+  queue_link(q, cmd);
+
+  /* the first command since the last drain wakes the consumer up */
+  if (!__atomic_exchange_n(&q->signalled, 1, __ATOMIC_ACQ_REL))
+  {
+#ifdef HAVE_SYS_EVENTFD_H
+    if (q->fd[0] == q->fd[1])
+    {
+      unsigned long long one = 1;
+      while (write(q->fd[1], &one, sizeof(one)) < 0 && errno == EINTR);
+    }
+    else
+#endif
+    {
+      char one = 1;
+      while (write(q->fd[1], &one, sizeof(one)) < 0 && errno == EINTR);
+    }
+  }
+
+  return True;
+}
+
+static void
+queue_clear_fd(AosdQueue* q)
+{
+  char buf[64];
+
+  /* an eventfd resets with one read, a pipe may hold a few bytes */
+  while (read(q->fd[0], buf, sizeof(buf)) > 0 && q->fd[0] != q->fd[1]);
+}
+
+static AosdCommand*
+queue_take(AosdQueue* q)
+{
+  AosdCommand* cmd = q->held;
+
+  if (cmd != NULL)
+  {
+    q->held = cmd->next;
+    return cmd;
+  }
+
+  return queue_pop(q);
+}
+
+static void
+run_command(AosdCommand* cmd)
+{
+  Aosd* aosd = cmd->aosd;
+  int* args = cmd->args;
+
+  switch (cmd->type)
+  {
+    case COMMAND_GEOMETRY:
+      aosd_set_geometry(aosd, args[0], args[1], args[2], args[3]);
+      break;
+
+    case COMMAND_POSITION:
+      aosd_set_position(aosd, args[0], args[1], args[2]);
+      break;
+
+    case COMMAND_SHOW:
+      aosd_show(aosd);
+      break;
+
+    case COMMAND_HIDE:
+      aosd_hide(aosd);
+      break;
+
+    case COMMAND_RENDER:
+      /* posted because what the renderer draws changed */
+      aosd_invalidate(aosd);
+      aosd_render(aosd);
+      break;
+
+    case COMMAND_FLASH:
+      aosd_flash_async(aosd, args[0], args[1], args[2], NULL, NULL);
+      break;
+
+    case COMMAND_CALL:
+      cmd->call(aosd, cmd->data);
+      break;
+  }
+}
+
+/* once a command has run, or never will */
+static void
+command_free(AosdCommand* cmd)
+{
+  if (cmd->destroy != NULL)
+    cmd->destroy(cmd->data);
+  free(cmd);
+}
+
+static void
+queue_destroy(AosdQueue* q)
+{
+  AosdCommand* cmd;
+
+  while ((cmd = queue_take(q)) != NULL)
+    command_free(cmd);
+
+  close(q->fd[0]);
+  if (q->fd[1] != q->fd[0])
+    close(q->fd[1]);
+  free(q);
+}
+
+/* False if a command destroyed the queue, and whatever owned it */
+Bool
+queue_drain(AosdQueue* q)
+{
+  AosdCommand* cmd;
+
+  /* a blocking aosd_flash() from a posted call runs a loop of its own,
+   * whatever comes in meanwhile waits until it's over */
+  if (q->draining)
+    return True;
+
+  q->draining = True;
+
+  /* clear the wakeup before looking, so a command that misses this
+   * drain signals again */
+  queue_clear_fd(q);
+  __atomic_store_n(&q->signalled, 0, __ATOMIC_SEQ_CST);
+
+  while (!q->dying && (cmd = queue_take(q)) != NULL)
+  {
+    run_command(cmd);
+    command_free(cmd);
+  }
+
+  q->draining = False;
+
+  if (q->dying)
+  {
+    queue_destroy(q);
+    return False;
+  }
+
+  return True;
+}
+
+void
+queue_forget(AosdQueue* q, Aosd* aosd)
+{
+  AosdCommand *cmd, **link;
+
+  /* move what's queued so far over to our side, minus the OSD's own;
+   * the rest still runs on the next drain, in order */
+  for (link = &q->held; *link != NULL; )
+    if ((*link)->aosd == aosd)
+    {
+      cmd = *link;
+      *link = cmd->next;
+      command_free(cmd);
+    }
+    else
+      link = &(*link)->next;
+
+  while ((cmd = queue_pop(q)) != NULL)
+    if (cmd->aosd == aosd)
+      command_free(cmd);
+    else
+    {
+      cmd->next = NULL;
+      *link = cmd;
+      link = &cmd->next;
+    }
+}
+
+void
+queue_free(AosdQueue* q)
+{
+  if (q == NULL)
+    return;
+
+  /* destroyed by one of its own commands, the drain frees it once
+   * that returns */
+  if (q->draining)
+  {
+    q->dying = True;
+    return;
+  }
+
+  queue_destroy(q);
+}
+
+static AosdCommand*
+command_new(Aosd* aosd, AosdCommandType type)
+{
+  AosdCommand* cmd = calloc(1, sizeof(AosdCommand));
+
+  if (cmd != NULL)
+  {
+    cmd->aosd = aosd;
+    cmd->type = type;
+  }
+
+  return cmd;
+}
+
+Bool
+aosd_post_geometry(Aosd* aosd, int x, int y, int width, int height)
+{
+  if (aosd == NULL)
+    return False;
+
+  AosdCommand* cmd = command_new(aosd, COMMAND_GEOMETRY);
+  if (cmd != NULL)
+  {
+    cmd->args[0] = x;
+    cmd->args[1] = y;
+    cmd->args[2] = width;
+    cmd->args[3] = height;
+  }
+
+  return queue_push(aosd->queue, cmd);
+}
+
+Bool
+aosd_post_position(Aosd* aosd, unsigned pos, int width, int height)
+{
+  if (aosd == NULL)
+    return False;
+
+  AosdCommand* cmd = command_new(aosd, COMMAND_POSITION);
+  if (cmd != NULL)
+  {
+    cmd->args[0] = pos;
+    cmd->args[1] = width;
+    cmd->args[2] = height;
+  }
+
+  return queue_push(aosd->queue, cmd);
+}
+
+Bool
+aosd_post_show(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return False;
+
+  return queue_push(aosd->queue, command_new(aosd, COMMAND_SHOW));
+}
+
+Bool
+aosd_post_hide(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return False;
+
+  return queue_push(aosd->queue, command_new(aosd, COMMAND_HIDE));
+}
+
+Bool
+aosd_post_render(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return False;
+
+  return queue_push(aosd->queue, command_new(aosd, COMMAND_RENDER));
+}
+
+Bool
+aosd_post_flash(Aosd* aosd,
+    unsigned fade_in_ms, unsigned full_ms, unsigned fade_out_ms)
+{
+  if (aosd == NULL)
+    return False;
+
+  AosdCommand* cmd = command_new(aosd, COMMAND_FLASH);
+  if (cmd != NULL)
+  {
+    cmd->args[0] = fade_in_ms;
+    cmd->args[1] = full_ms;
+    cmd->args[2] = fade_out_ms;
+  }
+
+  return queue_push(aosd->queue, cmd);
+}
+
+Bool
+aosd_post_call(Aosd* aosd, AosdCall call, void* user_data,
+    AosdDestroyNotify destroy)
+{
+  if (aosd == NULL || call == NULL)
+    return False;
+
+  AosdCommand* cmd = command_new(aosd, COMMAND_CALL);
+  if (cmd != NULL)
+  {
+    cmd->call = call;
+    cmd->data = user_data;
+    cmd->destroy = destroy;
+  }
+
+  return queue_push(aosd->queue, cmd);
+}
+
+int
+aosd_context_get_queue_fd(AosdContext* ctx)
+{
+  if (ctx == NULL)
+    return -1;
+
+  return ctx->queue->fd[0];
+}
+
+int
+aosd_get_queue_fd(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return -1;
+
+  return aosd->queue->fd[0];
+}
+
+/* vim: set ts=2 sw=2 et : */
@@ -0,0 +1,427 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * Notification stack, see aosd-stack.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "aosd-internal.h"
+#include "aosd-stack.h"
+
+typedef struct _StackItem StackItem;
+
+struct _StackItem
+{
+  StackItem* next;
+  unsigned id;
+  /* where it sits in the window */
+  int y, height;
+  AosdRenderer render_cb;
+  void* data;
+  AosdStackDoneCb done_cb;
+  /* microseconds, on the monotonic clock */
+  unsigned long long start, fade_in, full, fade_out;
+  /* as last composed, -1 to compose it again whatever it is now */
+  float alpha;
+  /* what the renderer drew, kept until it's told to draw again */
+  cairo_surface_t* surface;
+  /* sent on its way out early */
+  Bool dropped;
+};
+
+struct _AosdStack
+{
+  Aosd* aosd;
+  /* oldest first, top to bottom */
+  StackItem* items;
+  unsigned n_items;
+  unsigned limit;
+  unsigned last_id;
+
+  int width, spacing;
+  AosdCoordinate abscissa, ordinate;
+  int x_offset, y_offset;
+  /* messages came or went, everything moves */
+  Bool relayout;
+
+  /* the rectangles of one tick's changes */
+  XRectangle* rects;
+  unsigned n_rects;
+
+  /* a done_cb destroyed it in the middle of a tick, which frees it */
+  Bool ticking;
+  Bool dying;
+};
+
+static void
+stack_render(cairo_t* cr, void* data)
+{
+  AosdStack* stack = data;
+  StackItem* item;
+
+  for (item = stack->items; item != NULL; item = item->next)
+  {
+    if (item->alpha <= 0.0)
+      continue;
+
+    if (item->surface == NULL)
+    {
+      cairo_t* item_cr;
+
+      item->surface = cairo_surface_create_similar(cairo_get_target(cr),
+          CAIRO_CONTENT_COLOR_ALPHA, stack->width, item->height);
+      item_cr = cairo_create(item->surface);
+      if (item->render_cb != NULL)
+        item->render_cb(item_cr, item->data);
+      cairo_destroy(item_cr);
+    }
+
+    cairo_set_source_surface(cr, item->surface, 0, item->y);
+    cairo_paint_with_alpha(cr, item->alpha);
+  }
+}
+
+static StackItem*
+find_item(AosdStack* stack, unsigned id)
+{
+  StackItem* item;
+
+  for (item = stack->items; item != NULL; item = item->next)
+    if (item->id == id)
+      return item;
+
+  return NULL;
+}
+
+static void
+free_item(AosdStack* stack, StackItem* item, Bool completed)
+{
+  if (item->surface != NULL)
+    cairo_surface_destroy(item->surface);
+
+  if (item->done_cb != NULL)
+    item->done_cb(stack, item->id, completed, item->data);
+
+  free(item);
+}
+
+static void
+stack_free(AosdStack* stack)
+{
+  StackItem* item;
+
+  while ((item = stack->items) != NULL)
+  {
+    stack->items = item->next;
+    free_item(stack, item, False);
+  }
+
+  free(stack->rects);
+  free(stack);
+}
+
+/* stacks the messages up and fits the window around them */
+static void
+stack_layout(AosdStack* stack)
+{
+  StackItem* item;
+  int y = 0;
+
+  for (item = stack->items; item != NULL; item = item->next)
+  {
+    if (item != stack->items)
+      y += stack->spacing;
+    item->y = y;
+    y += item->height;
+  }
+
+  aosd_set_position_with_offset(stack->aosd, stack->abscissa,
+      stack->ordinate, stack->width, y, stack->x_offset, stack->y_offset);
+  stack->relayout = False;
+}
+
+/* the message's opacity at the given time, -1 once it's gone; due is
+ * when it next changes, a frame period away while it's fading */
+static float
+item_alpha(StackItem* item, unsigned long long now,
+    unsigned long long period, unsigned long long* due)
+{
+  unsigned long long t = now - item->start;
+
+  *due = now + period;
+
+  if (t < item->fade_in)
+    return t / (float)item->fade_in;
+
+  if (t < item->fade_in + item->full)
+  {
+    *due = item->start + item->fade_in + item->full;
+    return 1.0;
+  }
+
+  if (t < item->fade_in + item->full + item->fade_out)
+    return 1.0 - (t - item->fade_in - item->full) / (float)item->fade_out;
+
+  return -1;
+}
+
+/* fades a message out from wherever it is now */
+static void
+fade_out(StackItem* item, unsigned long long now)
+{
+  unsigned long long due;
+  float alpha = item_alpha(item, now, 0, &due);
+
+  /* already on its way out */
+  if (now - item->start >= item->fade_in + item->full)
+    return;
+
+  item->start = now - item->fade_in - item->full -
+    (unsigned long long)((1.0 - alpha) * item->fade_out);
+  item->dropped = True;
+}
+
+static unsigned long long
+stack_tick(Aosd* aosd, void* data)
+{
+  AosdStack* stack = data;
+  unsigned long long now = get_time_us(), next = 0, due;
+  unsigned long long period =
+    1000000ULL / (aosd->clock.fps ? aosd->clock.fps : AOSD_DEFAULT_FPS);
+  StackItem **link, *item;
+  float alpha;
+  unsigned n = 0;
+
+  for (link = &stack->items; (item = *link) != NULL; )
+  {
+    alpha = item_alpha(item, now, period, &due);
+
+    if (alpha < 0.0)
+    {
+      *link = item->next;
+      stack->n_items--;
+      stack->relayout = True;
+
+      stack->ticking = True;
+      free_item(stack, item, !item->dropped);
+      stack->ticking = False;
+      if (stack->dying)
+      {
+        stack_free(stack);
+        return 0;
+      }
+      continue;
+    }
+
+    if (next == 0 || due < next)
+      next = due;
+
+    /* only what changed gets composed again */
+    if (alpha != item->alpha)
+    {
+      item->alpha = alpha;
+
+      /* a done_cb above may have pushed more since we started */
+      if (n == stack->n_rects)
+      {
+        stack->n_rects = stack->n_items > n ? stack->n_items : n + 1;
+        stack->rects = realloc(stack->rects,
+            stack->n_rects * sizeof(XRectangle));
+      }
+
+      stack->rects[n].x = 0;
+      stack->rects[n].y = item->y;
+      stack->rects[n].width = stack->width;
+      stack->rects[n].height = item->height;
+      n++;
+    }
+
+    link = &item->next;
+  }
+
+  if (stack->items == NULL)
+  {
+    aosd_hide(aosd);
+    return 0;
+  }
+
+  if (stack->relayout)
+  {
+    stack_layout(stack);
+    aosd_invalidate(aosd);
+    if (aosd->shown)
+      aosd_render(aosd);
+    else
+      aosd_show(aosd);
+  }
+  else if (n > 0)
+    aosd_render_region(aosd, stack->rects, n);
+
+  return next;
+}
+
+static void
+stack_wake(AosdStack* stack)
+{
+  stack->aosd->ticker.next = get_time_us();
+}
+
+AosdStack*
+aosd_stack_new(Aosd* aosd, int width)
+{
+  AosdStack* stack;
+
+  if (aosd == NULL || width <= 0)
+    return NULL;
+
+  stack = calloc(1, sizeof(AosdStack));
+  stack->aosd = aosd;
+  stack->width = width;
+  stack->abscissa = COORDINATE_MAXIMUM;
+  stack->ordinate = COORDINATE_MINIMUM;
+
+  aosd_set_renderer(aosd, stack_render, stack);
+  aosd->ticker.tick = stack_tick;
+  aosd->ticker.data = stack;
+  aosd->ticker.next = 0;
+
+  return stack;
+}
+
+void
+aosd_stack_destroy(AosdStack* stack)
+{
+  if (stack == NULL || stack->dying)
+    return;
+
+  stack->dying = True;
+  memset(&stack->aosd->ticker, 0, sizeof(AosdTicker));
+  aosd_hide(stack->aosd);
+  aosd_set_renderer(stack->aosd, NULL, NULL);
+
+  if (!stack->ticking)
+    stack_free(stack);
+}
+
+void
+aosd_stack_set_layout(AosdStack* stack,
+    AosdCoordinate abscissa, AosdCoordinate ordinate,
+    int x_offset, int y_offset, int spacing)
+{
+  if (stack == NULL)
+    return;
+
+  stack->abscissa = abscissa;
+  stack->ordinate = ordinate;
+  stack->x_offset = x_offset;
+  stack->y_offset = y_offset;
+  stack->spacing = spacing;
+
+  if (stack->items != NULL)
+  {
+    stack->relayout = True;
+    stack_wake(stack);
+  }
+}
+
+void
+aosd_stack_set_limit(AosdStack* stack, unsigned max_messages)
+{
+  StackItem* item;
+  unsigned long long now = get_time_us();
+  unsigned n;
+
+  if (stack == NULL)
+    return;
+
+  stack->limit = max_messages;
+  if (max_messages == 0 || stack->n_items <= max_messages)
+    return;
+
+  for (item = stack->items, n = stack->n_items;
+      item != NULL && n > max_messages; item = item->next, n--)
+    fade_out(item, now);
+
+  stack_wake(stack);
+}
+
+unsigned
+aosd_stack_push(AosdStack* stack, int height,
+    AosdRenderer renderer, void* user_data, AosdStackDoneCb done_cb,
+    unsigned fade_in_ms, unsigned full_ms, unsigned fade_out_ms)
+{
+  StackItem *item, **link;
+  unsigned long long now = get_time_us();
+
+  if (stack == NULL || height <= 0)
+    return 0;
+
+  item = calloc(1, sizeof(StackItem));
+  if (++stack->last_id == 0)
+    ++stack->last_id;
+  item->id = stack->last_id;
+  item->height = height;
+  item->render_cb = renderer;
+  item->data = user_data;
+  item->done_cb = done_cb;
+  item->start = now;
+  item->fade_in = fade_in_ms * 1000ULL;
+  item->full = full_ms * 1000ULL;
+  item->fade_out = fade_out_ms * 1000ULL;
+  item->alpha = -1;
+
+  for (link = &stack->items; *link != NULL; link = &(*link)->next);
+  *link = item;
+  stack->n_items++;
+
+  /* make room, the oldest go first */
+  if (stack->limit != 0 && stack->n_items > stack->limit)
+    aosd_stack_set_limit(stack, stack->limit);
+
+  stack->relayout = True;
+  stack_wake(stack);
+
+  return item->id;
+}
+
+void
+aosd_stack_update(AosdStack* stack, unsigned id)
+{
+  StackItem* item;
+
+  if (stack == NULL || (item = find_item(stack, id)) == NULL)
+    return;
+
+  if (item->surface != NULL)
+  {
+    cairo_surface_destroy(item->surface);
+    item->surface = NULL;
+  }
+
+  item->alpha = -1;
+  stack_wake(stack);
+}
+
+void
+aosd_stack_remove(AosdStack* stack, unsigned id)
+{
+  StackItem* item;
+
+  if (stack == NULL || (item = find_item(stack, id)) == NULL)
+    return;
+
+  fade_out(item, get_time_us());
+  stack_wake(stack);
+}
+
+unsigned
+aosd_stack_get_count(AosdStack* stack)
+{
+  if (stack == NULL)
+    return 0;
+
+  return stack->n_items;
+}
+
+/* vim: set ts=2 sw=2 et : */
@@ -0,0 +1,66 @@
+/* aosd -- OSD with transparency, cairo, and pango.
+ *
+ * Notification stack: any number of messages in a single OSD window,
+ * one above the other, each fading in and out on its own:
+ *
+ *   AosdStack* stack = aosd_stack_new(aosd, 320);
+ *   aosd_stack_set_layout(stack, COORDINATE_MAXIMUM, COORDINATE_MINIMUM,
+ *       -10, 10, 4);
+ *   id = aosd_stack_push(stack, height, renderer, data, done_cb,
+ *       200, 3000, 500);
+ *
+ * Every message is rendered once into a surface of its own, and only the
+ * messages whose opacity changed get composed again, so a busy stack
+ * costs little more than an idle one.  Messages come and go without
+ * windows being created or destroyed.  The stack is driven by the OSD's
+ * main loop, like aosd_flash_async().
+ */
+
+#ifndef __AOSD_STACK_H__
+#define __AOSD_STACK_H__
+
+#include "aosd.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct _AosdStack AosdStack;
+
+/* a message is gone, its user_data may go too; completed is False for
+ * messages dropped before their time */
+typedef void (*AosdStackDoneCb)(AosdStack* stack, unsigned id,
+    Bool completed, void* user_data);
+
+/* the stack takes the OSD over, renderer, geometry and all, and has to
+ * be destroyed before it */
+AosdStack* aosd_stack_new(Aosd* aosd, int width);
+void aosd_stack_destroy(AosdStack* stack);
+
+/* where the stack sits, as with aosd_set_position_with_offset(); it
+ * grows and shrinks away from that edge.  spacing is between messages */
+void aosd_stack_set_layout(AosdStack* stack,
+    AosdCoordinate abscissa, AosdCoordinate ordinate,
+    int x_offset, int y_offset, int spacing);
+/* the oldest messages fade out early to keep this many; 0 for no limit */
+void aosd_stack_set_limit(AosdStack* stack, unsigned max_messages);
+
+/* the renderer draws the message once, into a width x height surface;
+ * returns the message's id, never 0 */
+unsigned aosd_stack_push(AosdStack* stack, int height,
+    AosdRenderer renderer, void* user_data, AosdStackDoneCb done_cb,
+    unsigned fade_in_ms, unsigned full_ms, unsigned fade_out_ms);
+/* the renderer would draw the message differently now */
+void aosd_stack_update(AosdStack* stack, unsigned id);
+/* fade the message out now */
+void aosd_stack_remove(AosdStack* stack, unsigned id);
+unsigned aosd_stack_get_count(AosdStack* stack);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AOSD_STACK_H__ */
+
+/* vim: set ts=2 sw=2 et : */
@@ -21,52 +21,175 @@
 
 #include "aosd-internal.h"
 
-Aosd*
-aosd_new(void)
+AosdContext*
+aosd_context_new(const char* display_name)
 {
-  Aosd* aosd = NULL;
-  Display* dsp = XOpenDisplay(NULL);
+  AosdContext* ctx = NULL;
+  Display* dsp = XOpenDisplay(display_name);
 
   if (dsp == NULL)
     fprintf(stderr, "libaosd: Couldn't open the display.\n");
   else
   {
-    int screen_num = DefaultScreen(dsp);
-    Window root_win = DefaultRootWindow(dsp);
+    ctx = calloc(1, sizeof(AosdContext));
+    ctx->display = dsp;
+    ctx->ids = XUniqueContext();
+    ctx->n_screens = ScreenCount(dsp);
+    ctx->screens = calloc(ctx->n_screens, sizeof(AosdScreen));
+    ctx->queue = queue_new();
+#ifdef HAVE_XCB
+    ctx->xcb = XGetXCBConnection(dsp);
+#endif
+    intern_atoms(ctx);
+  }
 
-    aosd = calloc(1, sizeof(Aosd));
-    aosd->display = dsp;
-    aosd->screen_num = screen_num;
-    aosd->root_win = root_win;
-    aosd->mode = TRANSPARENCY_NONE;
+  return ctx;
+}
 
-    make_window(aosd);
-    aosd_set_name(aosd, NULL);
+void
+aosd_context_destroy(AosdContext* ctx)
+{
+  if (ctx == NULL)
+    return;
+
+  while (ctx->osds != NULL)
+  {
+    ctx->osds->own_context = False;
+    aosd_destroy(ctx->osds);
   }
 
+  queue_free(ctx->queue);
+  free_screens(ctx);
+  discard_probes(ctx);
+  XCloseDisplay(ctx->display);
+  free(ctx);
+}
+
+Aosd*
+aosd_new_in_context(AosdContext* ctx, int screen)
+{
+  Aosd* aosd;
+
+  if (ctx == NULL)
+    return NULL;
+
+  if (screen < 0 || screen >= ctx->n_screens)
+    screen = DefaultScreen(ctx->display);
+
+  aosd = calloc(1, sizeof(Aosd));
+  aosd->context = ctx;
+  aosd->queue = ctx->queue;
+  aosd->display = ctx->display;
+  aosd->screen_num = screen;
+  aosd->root_win = RootWindow(ctx->display, screen);
+  aosd->monitor = MONITOR_SCREEN;
+  aosd->requested_mode = aosd->mode = TRANSPARENCY_NONE;
+  aosd->clock.fps = AOSD_DEFAULT_FPS;
+
+  aosd->next = ctx->osds;
+  ctx->osds = aosd;
+
+  stats_begin(aosd);
+  make_window(aosd);
+  aosd_set_name(aosd, NULL);
+  stats_end(aosd);
+
+  return aosd;
+}
+
+Aosd*
+aosd_new(void)
+{
+  AosdContext* ctx = aosd_context_new(NULL);
+  Aosd* aosd = aosd_new_in_context(ctx, -1);
+
+  if (aosd != NULL)
+    aosd->own_context = True;
+
+  return aosd;
+}
+
+Aosd*
+aosd_new_offscreen(int screen_width, int screen_height)
+{
+  Aosd* aosd;
+
+  if (screen_width <= 0 || screen_height <= 0)
+    return NULL;
+
+  aosd = calloc(1, sizeof(Aosd));
+  aosd->headless = True;
+  aosd->queue = queue_new();
+  aosd->offscreen.screen_width = screen_width;
+  aosd->offscreen.screen_height = screen_height;
+  aosd->monitor = MONITOR_SCREEN;
+  aosd->requested_mode = aosd->mode = TRANSPARENCY_NONE;
+  aosd->clock.fps = AOSD_DEFAULT_FPS;
+  aosd_set_name(aosd, NULL);
+
   return aosd;
 }
 
 void
 aosd_destroy(Aosd* aosd)
 {
+  AosdContext* ctx;
+  Aosd** link;
+
   if (aosd == NULL)
     return;
 
+  flash_stop(aosd, False);
+
+  if (aosd->headless)
+  {
+    queue_free(aosd->queue);
+    free_retained(aosd);
+    free_offscreen(aosd);
+    free(aosd->res_name);
+    free(aosd->res_class);
+    free(aosd);
+    return;
+  }
+
   aosd->root_win = None;
   make_window(aosd);
 
-  XCloseDisplay(aosd->display);
+  ctx = aosd->context;
+  queue_forget(ctx->queue, aosd);
+  for (link = &ctx->osds; *link != NULL; link = &(*link)->next)
+    if (*link == aosd)
+    {
+      *link = aosd->next;
+      break;
+    }
+
+  if (aosd->own_context)
+    aosd_context_destroy(ctx);
+  free(aosd->res_name);
+  free(aosd->res_class);
   free(aosd);
 }
 
+AosdContext*
+aosd_get_context(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return NULL;
+
+  return aosd->context;
+}
+
 void
 aosd_get_name(Aosd* aosd, XClassHint* result)
 {
   if (aosd == NULL || result == NULL)
     return;
 
-  XGetClassHint(aosd->display, aosd->win, result);
+  /* answered from our own copy instead of a round trip; XFree() is
+   * plain free(), so the strings still go back the documented way */
+  result->res_name = strdup(aosd->res_name);
+  result->res_class = strdup(aosd->res_class);
 }
 
 void
@@ -75,16 +198,12 @@ aosd_get_names(Aosd* aosd, char** res_name, char** res_class)
   if (aosd == NULL)
     return;
 
-  XClassHint ret;
-  aosd_get_name(aosd, &ret);
-
+  /* we know what we set, no need to ask the server */
   if (res_name != NULL)
-    *res_name = strdup(ret.res_name);
-  XFree(ret.res_name);
+    *res_name = strdup(aosd->res_name);
 
   if (res_class != NULL)
-    *res_class = strdup(ret.res_class);
-  XFree(ret.res_class);
+    *res_class = strdup(aosd->res_class);
 }
 
 AosdTransparency
@@ -96,6 +215,15 @@ aosd_get_transparency(Aosd* aosd)
   return aosd->mode;
 }
 
+AosdRenderMode
+aosd_get_render_mode(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return RENDER_SERVER;
+
+  return aosd->render_mode;
+}
+
 void
 aosd_get_geometry(Aosd* aosd, int* x, int* y, int* width, int* height)
 {
@@ -115,6 +243,15 @@ aosd_get_screen_size(Aosd* aosd, int* width, int* height)
   if (aosd == NULL)
     return;
 
+  if (aosd->headless)
+  {
+    if (width != NULL)
+      *width = aosd->offscreen.screen_width;
+    if (height != NULL)
+      *height = aosd->offscreen.screen_height;
+    return;
+  }
+
   Display* dsp = aosd->display;
   int scr = aosd->screen_num;
 
@@ -133,6 +270,43 @@ aosd_get_is_shown(Aosd* aosd)
   return aosd->shown;
 }
 
+int
+aosd_get_n_monitors(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return 0;
+
+  /* the virtual screen is all the monitor there is */
+  if (aosd->headless)
+    return 1;
+
+  return monitor_count(aosd);
+}
+
+void
+aosd_get_monitor_geometry(Aosd* aosd, int monitor,
+    int* x, int* y, int* width, int* height)
+{
+  XRectangle rect = {0, 0, 0, 0};
+
+  if (aosd != NULL && aosd->headless)
+  {
+    rect.width = aosd->offscreen.screen_width;
+    rect.height = aosd->offscreen.screen_height;
+  }
+  else if (aosd != NULL)
+    monitor_geometry(aosd, monitor, &rect);
+
+  if (x != NULL)
+    *x = rect.x;
+  if (y != NULL)
+    *y = rect.y;
+  if (width != NULL)
+    *width = rect.width;
+  if (height != NULL)
+    *height = rect.height;
+}
+
 void
 aosd_set_name(Aosd* aosd, XClassHint* name)
 {
@@ -149,7 +323,16 @@ aosd_set_name(Aosd* aosd, XClassHint* name)
     flag = True;
   }
 
-  XSetClassHint(aosd->display, aosd->win, name);
+  if (!aosd->headless)
+    XSetClassHint(aosd->display, aosd->win, name);
+
+  /* copy first, name may well be our own */
+  char* res_name = strdup(name->res_name ? name->res_name : "");
+  char* res_class = strdup(name->res_class ? name->res_class : "");
+  free(aosd->res_name);
+  free(aosd->res_class);
+  aosd->res_name = res_name;
+  aosd->res_class = res_class;
 
   if (flag)
     XFree(name);
@@ -168,19 +351,36 @@ aosd_set_names(Aosd* aosd, const char* res_name, const char* res_class)
 void
 aosd_set_transparency(Aosd* aosd, AosdTransparency mode)
 {
-  if (aosd == NULL || aosd->mode == mode)
+  if (aosd == NULL || aosd->requested_mode == mode)
     return;
 
-  // we have to preserve window name
-  XClassHint name;
-  aosd_get_name(aosd, &name);
+  /* the new window gets the name back by itself */
+  aosd->requested_mode = aosd->mode = mode;
+  if (!aosd->headless)
+  {
+    stats_begin(aosd);
+    make_window(aosd);
+    stats_end(aosd);
+  }
+}
 
-  aosd->mode = mode;
-  make_window(aosd);
+void
+aosd_set_render_mode(Aosd* aosd, AosdRenderMode mode)
+{
+  if (aosd == NULL)
+    return;
 
-  aosd_set_name(aosd, &name);
-  XFree(name.res_name);
-  XFree(name.res_class);
+  /* the buffers get rebuilt for the new mode on the next render */
+  aosd->render_mode = mode;
+}
+
+void
+aosd_set_fade_mode(Aosd* aosd, AosdFadeMode mode)
+{
+  if (aosd == NULL)
+    return;
+
+  aosd->fade_mode = mode;
 }
 
 void
@@ -194,7 +394,24 @@ aosd_set_geometry(Aosd* aosd, int x, int y, int width, int height)
   aosd->width  = width;
   aosd->height = height;
 
-  XMoveResizeWindow(aosd->display, aosd->win, x, y, width, height);
+  if (!aosd->headless)
+  {
+    stats_begin(aosd);
+    /* a shown OSD can't take a fresh snapshot, it'd see itself */
+    if (aosd->shown && aosd->mode == TRANSPARENCY_FAKE)
+      move_snapshot(aosd, x, y, width, height);
+    XMoveResizeWindow(aosd->display, aosd->win, x, y, width, height);
+    stats_end(aosd);
+  }
+}
+
+void
+aosd_set_monitor(Aosd* aosd, int monitor)
+{
+  if (aosd == NULL)
+    return;
+
+  aosd->monitor = monitor;
 }
 
 void
@@ -227,12 +444,13 @@ aosd_set_position_with_offset(Aosd* aosd,
   if (aosd == NULL)
     return;
 
-  int dsp_width, dsp_height;
+  int mon_x, mon_y, mon_width, mon_height;
 
-  aosd_get_screen_size(aosd, &dsp_width, &dsp_height);
+  aosd_get_monitor_geometry(aosd, aosd->monitor,
+      &mon_x, &mon_y, &mon_width, &mon_height);
 
-  int x = dsp_width - width;
-  int y = dsp_height - height;
+  int x = mon_width - width;
+  int y = mon_height - height;
 
   if (abscissa == COORDINATE_MINIMUM)
     x = 0;
@@ -250,7 +468,7 @@ aosd_set_position_with_offset(Aosd* aosd,
 
   y += y_offset;
 
-  aosd_set_geometry(aosd, x, y, width, height);
+  aosd_set_geometry(aosd, mon_x + x, mon_y + y, width, height);
 }
 
 void
@@ -259,10 +477,49 @@ aosd_set_renderer(Aosd* aosd, AosdRenderer renderer, void* user_data)
   if (aosd == NULL)
     return;
 
+  damage_retained(aosd, NULL, 0);
+
+  /* a flash keeps showing the old output until it sees this */
+  if (aosd->flash.active)
+  {
+    aosd->flash.user_render.render_cb = renderer;
+    aosd->flash.user_render.data = user_data;
+    aosd->flash.stale = True;
+    if (aosd->flash.fade != FADE_OPACITY)
+      return;
+  }
+
   aosd->renderer.render_cb = renderer;
   aosd->renderer.data = user_data;
 }
 
+void
+aosd_set_retained(Aosd* aosd, Bool enable)
+{
+  if (aosd == NULL)
+    return;
+
+  aosd->retained.enabled = enable;
+  if (!enable)
+    free_retained(aosd);
+}
+
+void
+aosd_invalidate(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return;
+
+  damage_retained(aosd, NULL, 0);
+
+  /* a flash holds on to the output of its own accord */
+  if (aosd->flash.active)
+  {
+    aosd->flash.stale = True;
+    aosd->clock.next = get_time_us();
+  }
+}
+
 void
 aosd_set_mouse_event_cb(Aosd* aosd, AosdMouseEventCb cb, void* user_data)
 {
@@ -282,69 +539,238 @@ aosd_set_hide_upon_mouse_event(Aosd* aosd, Bool enable)
   aosd->mouse_hide = enable;
 }
 
+static void
+render_buffer(Aosd* aosd, AosdBuffer* buf, const XRectangle* rects, int n)
+{
+  cairo_surface_t* surf = buf->surface;
+  int i;
+
+  if (aosd->resources.image != NULL)
+  {
+    /* rasterize on our side, the pixmap only gets the finished frame */
+    wait_for_upload(aosd);
+    surf = aosd->resources.image_surface;
+    cairo_surface_flush(surf);
+    client_background(aosd, rects, n);
+  }
+  else
+    server_background(aosd, buf, rects, n);
+
+  /* render with cairo */
+  if (aosd->renderer.render_cb)
+  {
+    /* the pixels were touched behind cairo's back */
+    cairo_surface_mark_dirty(surf);
+
+    cairo_t* cr = cairo_create(surf);
+
+    /* keep the renderer off everything outside the dirty area */
+    if (rects != NULL)
+    {
+      for (i = 0; i < n; i++)
+        cairo_rectangle(cr,
+            rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+      cairo_clip(cr);
+    }
+
+    /* draw some stuff */
+    call_renderer(aosd, cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(surf);
+  }
+
+  if (aosd->resources.image != NULL)
+    upload_image(aosd, buf, rects, n);
+
+  aosd->stats.renders++;
+}
+
+/* what a window would show, minus the window: an empty frame with the
+ * renderer's output on top */
+static void
+render_offscreen(Aosd* aosd, const XRectangle* rects, int n)
+{
+  cairo_surface_t* surf;
+  cairo_t* cr;
+  int i;
+
+  if (!make_offscreen(aosd))
+    return;
+
+  surf = aosd->offscreen.surface;
+  cr = cairo_create(surf);
+
+  if (rects != NULL)
+  {
+    for (i = 0; i < n; i++)
+      cairo_rectangle(cr,
+          rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+    cairo_clip(cr);
+  }
+
+  cairo_save(cr);
+  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint(cr);
+  cairo_restore(cr);
+
+  call_renderer(aosd, cr);
+
+  cairo_destroy(cr);
+  cairo_surface_flush(surf);
+  aosd->stats.renders++;
+}
+
+void
+aosd_set_offscreen_buffer(Aosd* aosd,
+    unsigned char* data, int width, int height, int stride)
+{
+  if (aosd == NULL || !aosd->headless)
+    return;
+
+  if (data != NULL &&
+      (width <= 0 || height <= 0 ||
+       stride < cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width)))
+    return;
+
+  /* the next render picks the new target up */
+  free_offscreen(aosd);
+  aosd->offscreen.data = data;
+  aosd->offscreen.width = width;
+  aosd->offscreen.height = height;
+  aosd->offscreen.stride = stride;
+}
+
+cairo_surface_t*
+aosd_get_offscreen_surface(Aosd* aosd)
+{
+  if (aosd == NULL || !aosd->headless)
+    return NULL;
+
+  return aosd->offscreen.surface;
+}
+
+void
+aosd_set_frame_rate(Aosd* aosd, unsigned fps)
+{
+  if (aosd == NULL)
+    return;
+
+  aosd->clock.fps = fps;
+}
+
+void
+aosd_set_frame_cb(Aosd* aosd, AosdFrameCb cb, void* user_data)
+{
+  if (aosd == NULL)
+    return;
+
+  aosd->animator.frame_cb = cb;
+  aosd->animator.data = user_data;
+}
+
 void
 aosd_render(Aosd* aosd)
 {
   if (aosd == NULL)
     return;
 
+  AosdBuffer* buf;
+
+  if (aosd->headless)
+  {
+    render_offscreen(aosd, NULL, 0);
+    return;
+  }
+
+  stats_begin(aosd);
+
+  /* an XRender flash has no renderer to call, only its own copy of the
+   * output to blend in; it picks up a new one itself once invalidated */
+  if (aosd->flash.active && aosd->flash.fade == FADE_XRENDER)
+  {
+    present_content(aosd, aosd->flash.alpha);
+    stats_end(aosd);
+    return;
+  }
+
+  /* reuse the pixmaps and surfaces unless size, depth or visual changed */
+  if (make_resources(aosd))
+  {
+    /* draw into the buffer the window isn't currently showing */
+    buf = &aosd->resources.buffer[!aosd->resources.front];
+    wait_for_buffer(aosd, buf);
+    render_buffer(aosd, buf, NULL, 0);
+
+    present_buffer(aosd, buf);
+    swap_buffers(aosd);
+    aosd->resources.presented = True;
+  }
+
+  stats_end(aosd);
+}
+
+void
+aosd_render_region(Aosd* aosd, const XRectangle* rects, int n)
+{
+  if (aosd == NULL || rects == NULL || n <= 0)
+    return;
+
   Display* dsp = aosd->display;
-  int scr = aosd->screen_num;
-  int width = aosd->width, height = aosd->height;
   Window win = aosd->win;
-  Pixmap pixmap;
-  GC gc;
+  AosdBuffer *back, *front;
+  int i;
 
-  if (aosd->mode == TRANSPARENCY_COMPOSITE)
+  damage_retained(aosd, rects, n);
+
+  if (aosd->headless)
   {
-    pixmap = XCreatePixmap(dsp, win, width, height, 32);
-    gc = XCreateGC(dsp, pixmap, 0, NULL);
-    XFillRectangle(dsp, pixmap, gc, 0, 0, width, height);
+    render_offscreen(aosd, rects, n);
+    return;
   }
-  else
+
+  /* an XRender flash has no renderer to patch with, it blends in its
+   * own copy of the output and picks up the new one on its next frame */
+  if (aosd->flash.active && aosd->flash.fade == FADE_XRENDER)
   {
-    pixmap = XCreatePixmap(dsp, win, width, height, DefaultDepth(dsp, scr));
-    gc = XCreateGC(dsp, pixmap, 0, NULL);
-    if (aosd->mode == TRANSPARENCY_FAKE)
-      /* make our own copy of the background pixmap as the initial surface */
-      XCopyArea(dsp, aosd->background.pixmap, pixmap, gc,
-          0, 0, width, height, 0, 0);
-    else
-      XFillRectangle(dsp, pixmap, gc, 0, 0, width, height);
+    aosd_invalidate(aosd);
+    stats_begin(aosd);
+    present_content(aosd, aosd->flash.alpha);
+    stats_end(aosd);
+    return;
   }
-  XFreeGC(dsp, gc);
 
-  /* render with cairo */
-  if (aosd->renderer.render_cb)
+  /* nothing retained to patch up yet, so do it the hard way */
+  if (!make_resources(aosd) || !aosd->resources.presented)
   {
-    /* create cairo surface using the pixmap */
-    XRenderPictFormat* xrformat;
-    cairo_surface_t* surf;
-    if (aosd->mode == TRANSPARENCY_COMPOSITE)
-      xrformat = XRenderFindVisualFormat(dsp, aosd->visual);
-    else
-      xrformat = XRenderFindVisualFormat(dsp, DefaultVisual(dsp, scr));
+    aosd_render(aosd);
+    return;
+  }
 
-    surf = cairo_xlib_surface_create_with_xrender_format(
-        dsp, pixmap, ScreenOfDisplay(dsp, scr), xrformat, width, height);
+  stats_begin(aosd);
 
-    /* draw some stuff */
-    cairo_t* cr = cairo_create(surf);
-    aosd->renderer.render_cb(cr, aosd->renderer.data);
-    cairo_destroy(cr);
-    cairo_surface_destroy(surf);
-  }
+  back = &aosd->resources.buffer[!aosd->resources.front];
+  front = &aosd->resources.buffer[aosd->resources.front];
 
-  /* point window at its new backing pixmap */
-  XSetWindowBackgroundPixmap(dsp, win, pixmap);
+  /* both get written to, neither may still be on its way to the screen */
+  wait_for_buffer(aosd, back);
+  wait_for_buffer(aosd, front);
+  render_buffer(aosd, back, rects, n);
 
-  /* I think it's ok to free it here because XCreatePixmap(3X11) says: "the X
-   * server frees the pixmap storage when there are no references to it".
-   */
-  XFreePixmap(dsp, pixmap);
+  /* patch the window's background pixmap and expose only what changed */
+  for (i = 0; i < n; i++)
+  {
+    /* XClearArea() treats a zero extent as "up to the edge" */
+    if (rects[i].width == 0 || rects[i].height == 0)
+      continue;
+
+    XCopyArea(dsp, back->pixmap, front->pixmap, front->gc,
+        rects[i].x, rects[i].y, rects[i].width, rects[i].height,
+        rects[i].x, rects[i].y);
+    XClearArea(dsp, win,
+        rects[i].x, rects[i].y, rects[i].width, rects[i].height, False);
+  }
 
-  /* and tell the window to redraw with this pixmap */
-  XClearWindow(dsp, win);
+  stats_end(aosd);
 }
 
 void
@@ -353,20 +779,17 @@ aosd_show(Aosd* aosd)
   if (aosd == NULL || aosd->shown)
     return;
 
-  if (aosd->mode == TRANSPARENCY_FAKE)
-  {
-    if (aosd->background.set)
-    {
-      XFreePixmap(aosd->display, aosd->background.pixmap);
-      aosd->background.set = False;
-    }
-    aosd->background.pixmap = take_snapshot(aosd);
-    aosd->background.set = True;
-  }
+  stats_begin(aosd);
+
+  if (aosd->mode == TRANSPARENCY_FAKE && !aosd->headless)
+    update_snapshot(aosd);
 
   aosd_render(aosd);
-  XMapRaised(aosd->display, aosd->win);
+  if (!aosd->headless)
+    XMapRaised(aosd->display, aosd->win);
   aosd->shown = True;
+
+  stats_end(aosd);
 }
 
 void
@@ -375,8 +798,40 @@ aosd_hide(Aosd* aosd)
   if (aosd == NULL || !aosd->shown)
     return;
 
-  XUnmapWindow(aosd->display, aosd->win);
+  /* that's the end of a flash, which comes back here to hide */
+  if (aosd->flash.active)
+  {
+    flash_stop(aosd, False);
+    return;
+  }
+
   aosd->shown = False;
+  if (aosd->headless)
+    return;
+
+  stats_begin(aosd);
+  XUnmapWindow(aosd->display, aosd->win);
+  aosd->remap = 0;
+  snapshot_hidden(aosd);
+  stats_end(aosd);
+}
+
+void
+aosd_get_stats(Aosd* aosd, AosdStats* stats)
+{
+  if (aosd == NULL || stats == NULL)
+    return;
+
+  *stats = aosd->stats;
+}
+
+void
+aosd_reset_stats(Aosd* aosd)
+{
+  if (aosd == NULL)
+    return;
+
+  memset(&aosd->stats, 0, sizeof(AosdStats));
 }
 
 /* vim: set ts=2 sw=2 et : */
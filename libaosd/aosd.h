@@ -23,6 +23,9 @@ extern "C"
 /* global object type */
 typedef struct _Aosd Aosd;
 
+/* X connection shared by any number of OSDs */
+typedef struct _AosdContext AosdContext;
+
 // relative coordinates for positioning
 typedef enum {
   COORDINATE_MINIMUM = 0,
@@ -46,9 +49,68 @@ typedef struct
 }
 AosdMouseEvent;
 
+/* timing of an animation frame, handed out before it gets rendered */
+typedef struct
+{
+  // monotonic timestamp of the frame, in microseconds
+  unsigned long long time_us;
+
+  // frames rendered and frames dropped so far in this animation
+  unsigned int frame;
+  unsigned int dropped;
+
+  // opacity the frame is going to be rendered with
+  float alpha;
+}
+AosdFrame;
+
+#define AOSD_HISTOGRAM_BUCKETS 20
+
+/* durations in microseconds; bucket i counts those shorter than 2^i
+ * and at least 2^(i-1), the last one everything longer */
+typedef struct
+{
+  unsigned long long count;
+  unsigned long long total_us;
+  unsigned long long max_us;
+  unsigned long long buckets[AOSD_HISTOGRAM_BUCKETS];
+}
+AosdHistogram;
+
+/* what an OSD has cost so far, see aosd_get_stats() */
+typedef struct
+{
+  // frames drawn, and the time the renderer took drawing them
+  unsigned long long renders;
+  AosdHistogram render_time;
+
+  // pixmaps and surfaces built for a new size, depth or mode
+  AosdHistogram setup_time;
+
+  // X requests sent on the OSD's behalf, and the ones waiting for a reply
+  unsigned long long requests;
+  unsigned long long round_trips;
+
+  // pixels sent from client-side rendering, in bytes
+  unsigned long long bytes_uploaded;
+
+  // X events the main loop handed to the OSD
+  unsigned long long events;
+
+  // frames shown and dropped by flashes
+  unsigned long long frames;
+  unsigned long long frames_dropped;
+}
+AosdStats;
+
 /* various callbacks */
 typedef void (*AosdRenderer)(cairo_t* cr, void* user_data);
 typedef void (*AosdMouseEventCb)(AosdMouseEvent* event, void* user_data);
+typedef void (*AosdFrameCb)(AosdFrame* frame, void* user_data);
+typedef void (*AosdCall)(Aosd* aosd, void* user_data);
+typedef void (*AosdDestroyNotify)(void* user_data);
+// completed is False for a flash cancelled or hidden before its end
+typedef void (*AosdFlashCb)(Aosd* aosd, Bool completed, void* user_data);
 
 typedef enum
 {
@@ -57,34 +119,111 @@ typedef enum
   TRANSPARENCY_COMPOSITE
 } AosdTransparency;
 
+/* where the renderer's cairo primitives get rasterized */
+typedef enum
+{
+  RENDER_SERVER = 0,
+  RENDER_CLIENT
+} AosdRenderMode;
+
+/* how aosd_flash() animates the opacity */
+typedef enum
+{
+  // FADE_OPACITY where _NET_SUPPORTED lists _NET_WM_WINDOW_OPACITY,
+  // FADE_XRENDER everywhere else
+  FADE_AUTO = 0,
+  // re-render through cairo every frame
+  FADE_RENDER,
+  // render once, let the compositor apply _NET_WM_WINDOW_OPACITY
+  FADE_OPACITY,
+  // render once, blend the server-side copy with XRender every frame
+  FADE_XRENDER
+} AosdFadeMode;
+
+/* which monitor positioning is relative to; anything from 0 up is an
+ * index into the monitors aosd_get_n_monitors() counts */
+typedef enum
+{
+  // the whole X screen, however many monitors it spans
+  MONITOR_SCREEN = -3,
+  // the one the pointer is on
+  MONITOR_POINTER,
+  // the primary one, or the first
+  MONITOR_PRIMARY
+} AosdMonitor;
+
 /* object (de)allocators */
 Aosd* aosd_new(void);
 void aosd_destroy(Aosd* aosd);
 
+/* aosd_new() opens a connection of its own for every OSD; OSDs created in
+ * a context share its connection instead.  a negative screen means the
+ * default one, and destroying the context destroys the OSDs left on it */
+AosdContext* aosd_context_new(const char* display_name);
+void aosd_context_destroy(AosdContext* ctx);
+Aosd* aosd_new_in_context(AosdContext* ctx, int screen);
+
+/* an OSD that needs no display at all and renders into memory instead;
+ * positioning works against a virtual screen of the given size, and
+ * aosd_flash() and the renderer behave as they do on X.  the frame is
+ * drawn into a buffer of our own, or into the caller's ARGB32 pixels
+ * (cairo's premultiplied, native-endian layout) once one is set; NULL
+ * data goes back to our own.  aosd_get_offscreen_surface() hands out
+ * the last frame, owned by the OSD, and NULL for OSDs on a display */
+Aosd* aosd_new_offscreen(int screen_width, int screen_height);
+void aosd_set_offscreen_buffer(Aosd* aosd,
+    unsigned char* data, int width, int height, int stride);
+cairo_surface_t* aosd_get_offscreen_surface(Aosd* aosd);
+
 /* object inspectors */
+AosdContext* aosd_get_context(Aosd* aosd);
 void aosd_get_name(Aosd* aosd, XClassHint* result);
 void aosd_get_names(Aosd* aosd, char** res_name, char** res_class);
 AosdTransparency aosd_get_transparency(Aosd* aosd);
+AosdRenderMode aosd_get_render_mode(Aosd* aosd);
 void aosd_get_geometry(Aosd* aosd, int* x, int* y, int* width, int* height);
 void aosd_get_screen_size(Aosd* aosd, int* width, int* height);
 Bool aosd_get_is_shown(Aosd* aosd);
+/* the monitor layout is cached per screen and kept up to date as
+ * monitors come and go, so these cost no round trips (MONITOR_POINTER
+ * aside); unknown indices fall back to MONITOR_PRIMARY */
+int aosd_get_n_monitors(Aosd* aosd);
+void aosd_get_monitor_geometry(Aosd* aosd, int monitor,
+    int* x, int* y, int* width, int* height);
 
 /* object configurators */
 void aosd_set_name(Aosd* aosd, XClassHint* name);
 void aosd_set_names(Aosd* aosd, const char* res_name, const char* res_class);
 void aosd_set_transparency(Aosd* aosd, AosdTransparency mode);
+void aosd_set_render_mode(Aosd* aosd, AosdRenderMode mode);
+void aosd_set_fade_mode(Aosd* aosd, AosdFadeMode mode);
 void aosd_set_geometry(Aosd* aosd, int x, int y, int width, int height);
+/* aosd_set_position() and aosd_set_position_with_offset() place the OSD
+ * on this monitor; MONITOR_SCREEN, the default, spans them all */
+void aosd_set_monitor(Aosd* aosd, int monitor);
 void aosd_set_position(Aosd* aosd, unsigned pos, int width, int height);
 void aosd_set_position_offset(Aosd* aosd, int x_offset, int y_offset);
 void aosd_set_position_with_offset(Aosd* aosd,
     AosdCoordinate abscissa, AosdCoordinate ordinate, int width, int height,
     int x_offset, int y_offset);
 void aosd_set_renderer(Aosd* aosd, AosdRenderer renderer, void* user_data);
+/* in retained mode the renderer's output is kept, and shown again on
+ * aosd_show(), aosd_render(), fades and moves instead of calling the
+ * renderer once more; it's painted over the background like anything
+ * else the renderer draws.  the renderer runs again after
+ * aosd_invalidate(), a new aosd_set_renderer() or a resize, and only
+ * for the rectangles given to aosd_render_region().  invalidating also
+ * has a running flash pick up what the renderer draws now */
+void aosd_set_retained(Aosd* aosd, Bool enable);
+void aosd_invalidate(Aosd* aosd);
 void aosd_set_mouse_event_cb(Aosd* aosd, AosdMouseEventCb cb, void* user_data);
 void aosd_set_hide_upon_mouse_event(Aosd* aosd, Bool enable);
+void aosd_set_frame_rate(Aosd* aosd, unsigned fps);
+void aosd_set_frame_cb(Aosd* aosd, AosdFrameCb cb, void* user_data);
 
 /* object manipulators */
 void aosd_render(Aosd* aosd);
+void aosd_render_region(Aosd* aosd, const XRectangle* rects, int n);
 void aosd_show(Aosd* aosd);
 void aosd_hide(Aosd* aosd);
 
@@ -92,10 +231,68 @@ void aosd_hide(Aosd* aosd);
 void aosd_loop_once(Aosd* aosd);
 void aosd_loop_for(Aosd* aosd, unsigned loop_ms);
 
+/* integration with an external main loop: watch aosd_get_fd() for input,
+ * call aosd_flush() before going to sleep for at most aosd_get_timeout()
+ * milliseconds (-1 means no timeout), and aosd_dispatch() after waking up.
+ * None of them waits for the server; aosd_sync() does, when you must. */
+int aosd_get_fd(Aosd* aosd);
+int aosd_get_timeout(Aosd* aosd);
+void aosd_dispatch(Aosd* aosd);
+void aosd_flush(Aosd* aosd);
+void aosd_sync(Aosd* aosd);
+
+/* the same for every OSD in a context at once; the per-OSD calls above
+ * act on the OSD's whole context too */
+int aosd_context_get_fd(AosdContext* ctx);
+int aosd_context_get_timeout(AosdContext* ctx);
+void aosd_context_dispatch(AosdContext* ctx);
+void aosd_context_flush(AosdContext* ctx);
+
+/* thread-safe front end: any thread may post these at any time, they
+ * queue a command and return without touching X.  the thread driving
+ * the OSD runs them in order on its next aosd_loop_once() or
+ * aosd_dispatch(); external loops watch aosd_get_queue_fd() for input
+ * alongside aosd_get_fd().  aosd_post_call() runs anything else, like
+ * changing what the renderer draws, on that thread; destroy, if not
+ * NULL, gets user_data once the call has run or is dropped along with
+ * the OSD or its context without running.  the OSD has to outlive
+ * what's posted to it; False means we ran out of memory, and destroy
+ * isn't called then */
+Bool aosd_post_geometry(Aosd* aosd, int x, int y, int width, int height);
+Bool aosd_post_position(Aosd* aosd, unsigned pos, int width, int height);
+Bool aosd_post_show(Aosd* aosd);
+Bool aosd_post_hide(Aosd* aosd);
+/* invalidates the retained output first, see aosd_set_retained() */
+Bool aosd_post_render(Aosd* aosd);
+Bool aosd_post_flash(Aosd* aosd,
+    unsigned fade_in_ms, unsigned full_ms, unsigned fade_out_ms);
+Bool aosd_post_call(Aosd* aosd, AosdCall call, void* user_data,
+    AosdDestroyNotify destroy);
+int aosd_get_queue_fd(Aosd* aosd);
+int aosd_context_get_queue_fd(AosdContext* ctx);
+
 /* automatic object manipulator */
 void aosd_flash(Aosd* aosd, unsigned fade_in_ms,
     unsigned full_ms, unsigned fade_out_ms);
 
+/* the same without blocking: the flash is advanced by the loop functions,
+ * aosd_dispatch() and friends, so any number of OSDs can flash on one
+ * thread.  done_cb runs once it's over.  flashing an OSD that's flashing
+ * already, or retargeting it, fades it back in from its current opacity
+ * and holds it for the new times, re-rendering what the renderer draws
+ * now; the previous done_cb is told it didn't complete.  hiding the OSD
+ * or aosd_flash_cancel() end the flash early */
+void aosd_flash_async(Aosd* aosd,
+    unsigned fade_in_ms, unsigned full_ms, unsigned fade_out_ms,
+    AosdFlashCb done_cb, void* user_data);
+void aosd_flash_retarget(Aosd* aosd, unsigned full_ms, unsigned fade_out_ms);
+void aosd_flash_cancel(Aosd* aosd);
+
+/* runtime statistics, counted since the OSD was created or last reset;
+ * cheap enough to leave on, and safe to export as they are */
+void aosd_get_stats(Aosd* aosd, AosdStats* stats);
+void aosd_reset_stats(Aosd* aosd);
+
 #ifdef __cplusplus
 }
 #endif